@@ -5,6 +5,7 @@
 #include "esp_adc_cal.h"
 #include "driver/rtc_io.h"
 #include <math.h>
+#include "Sequence.h"
 
 enum BatteryLevel {
     BATTERY_CRITICAL = 0,
@@ -17,10 +18,36 @@ class Battery {
 public:
     Battery(gpio_num_t battery_gpio, adc1_channel_t channel, adc_unit_t adcUnit);
 
-    void setup();
-    int getBatteryLevel() const;                // returns e.g., Battery_LOW
+    Battery(const Battery&) = delete;           // the measurement refers back to this battery
+
+    void setup();                               // starts calibrating the voltage limits
+    void update();                              // non-blocking supply voltage sampling
+    void startMeasurement();                    // battery level, averaged without blocking
+    bool updateMeasurement();                   // true when a measurement finished on this call
+    bool isMeasuring() const;
+    unsigned long timeToNextStep() const;       // ms until the measurement wants to run again
+    int getBatteryLevel() const;                // last measured, e.g., Battery_LOW
+    float getSupplyVoltage() const;             // smoothed voltage under load in V
 
 private:
+    // numReading reads numReadingInterval apart, repeated while the limits are calibrated
+    class Measurement : public Sequence {
+    public:
+        Measurement(Battery& battery) : battery(battery) {}
+        void begin(bool calibrate);
+    private:
+        enum { SAMPLE, AVERAGE };
+        Battery& battery;
+        bool calibrating = false;
+        int calibrations = 0;
+        int readings = 0;
+        float sum = 0.0f;
+        void step() override;
+    };
+    Measurement measurement{*this};
+    int level = BATTERY_HIGH;                   // until the first measurement
+
+
 	gpio_num_t battery_gpio;
     adc_unit_t adcUnit;
     adc1_channel_t adcChannel;
@@ -33,22 +60,28 @@ private:
     const float voltageDividerRatio = (R1 + R2) / R2; 
 
     const int numReading = 10;                  // num readings to average for a accurate measurement
+    const unsigned long numReadingInterval = 10; // ms between them
     const int numCalibrations = 10;             // num of times to sample voltage to calibrate voltage limits
 
     const int batteryModerateThreshold = 70;    // percentage 
     const int batteryWarningThreshold = 30;     // percentage
     const int batteryCriticalThreshold = 7;     // percentage
 
+    // Supply voltage tracking, one ADC read per interval
+    float supplyVoltage = 0.0f;
+    unsigned long lastSupplySampleTime = 0;
+    const unsigned long supplySampleInterval = 100; // ms
+    const float supplyAlpha = 0.2f;
+
     const float voltageCalibOffset = 0.1f;
     const float voltageCalibEpsilon = 0.01f;
     const float learningRate = 0.3f;
 
-    int getBatteryPercentage() const;           // returns 0 - 100%
     float readRawVoltage() const;               // returns voltage in V
-    float getStableVoltage() const;             // returns voltage in V
+    int levelFor(float voltage) const;
     void maybeUpdateFullVoltage(float voltage);
     void maybeUpdateEmptyVoltage(float voltage);
-    void calibrateVoltageLimits();
+    bool calibrateVoltageLimits(float voltage); // false once the voltage is within the expected range
     float voltageToPercentage(float voltage) const;
 };
 
@@ -0,0 +1,46 @@
+#ifndef BEANPROFILES_H
+#define BEANPROFILES_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "FlowModel.h"
+
+enum FeedMode {
+	FEED_CONTINUOUS = 0,
+	FEED_PULSED     = 1,  // on/off pulses for light or oily beans that clump at low speed
+};
+
+// Named bean profiles, each with its own learned flow curve and wanted feed rate, stored in NVS
+class BeanProfiles {
+public:
+	void setup();
+	void next();                      // switch to the next profile
+	void save();                      // persist the active profile if it changed
+
+	int getIndex() const;
+	const char* getName() const;
+	FeedMode getFeedMode() const;
+	void toggleFeedMode();            // persisted right away
+	FlowModel& getFlowModel();
+	float getTargetRate() const;      // g/s
+	void setTargetRate(float rate);
+
+private:
+	static const int numProfiles = 4;
+	static const char* const names[numProfiles];
+	static const FeedMode defaultFeedModes[numProfiles];
+	const char* nvsNamespace = "profiles";
+	const float defaultTargetRate = 0.6f;   // g/s
+	const float targetRateEpsilon = 0.01f;
+
+	Preferences prefs;
+	FlowModel flowModel;
+	int active = 0;
+	float targetRate = 0.6f;
+	FeedMode feedMode = FEED_CONTINUOUS;
+	bool targetModified = false;
+
+	void load();
+};
+
+#endif
@@ -2,24 +2,93 @@
 #define BOARD_H
 
 #include <Arduino.h>
-#include <Button.h>
+#include <ButtonEngine.h>
+#include <ButtonBank.h>
+#include <GestureRecognizer.h>
 #include "LoadCell.h"
 #include "Motor.h"
 #include "Buzzer.h"
 #include "Battery.h"
+#include "FlowController.h"
+#include "BeanProfiles.h"
+#include "MotorCharacterizer.h"
+#include "PulseFeeder.h"
+#include "PwmSweep.h"
+#include "EventLoop.h"
+#include "PowerProfile.h"
+#include "Sequence.h"
+#include "BoardState.h"
+#include "SafetyCutoff.h"
+#include "SleepPins.h"
 #include "driver/rtc_io.h"
 
 #define HAS_LOADCELL       true
 #define HAS_BATTERYMONITOR false
 #define HAS_BUZZER         false
+#define HAS_FLOWCONTROL    false // closed-loop feed rate, requires HAS_LOADCELL
+#define HAS_PWMSWEEP       false // characterisation also picks the PWM frequency, requires HAS_LOADCELL
+#define HAS_BUTTONBANK     false // sampled vertical counter debouncing instead of edge interrupts
+#define HAS_POURWAKE       false // deep sleep timer wakes a minimal path that weighs the hopper, beans poured in wake the board, requires HAS_LOADCELL
+#define HAS_SAFETYCUTOFF   true  // over-dose and runaway cutoff in the load cell acquisition task, requires HAS_LOADCELL
+#define HAS_HOPPERCHECK    true  // while idle the load cell is powered only for a periodic hopper reading, requires HAS_LOADCELL
 #define CALIBRATION_FACTOR -2520.0f
 
-enum ButtonStatus {
-    BUTTON_IDLE         = 0,
-    BUTTON_HOLD         = 1,
-    BUTTON_CLICK        = 2,
-    BUTTON_DOUBLE_CLICK = 3,
+#ifndef SAFETY_SIMULATION
+#define SAFETY_SIMULATION  false // a synthetic runaway feed replaces the load cell, see the safety-sim env
+#endif
+
+#ifndef BOOT_PROFILING
+#define BOOT_PROFILING     false // prints the time of each boot stage up to the first motor duty, see the boot-profiling env
+#endif
+
+#ifndef SLEEP_AUDIT
+#define SLEEP_AUDIT        false // checks the pads against the sleep pin plan before every deep sleep, see the sleep-audit env
+#endif
+
+#ifndef LOOP_PROFILING
+#define LOOP_PROFILING     false // reports how much of the awake time the loop runs, see the loop-profiling env
+#endif
+
+// ids handed out by addButton(), in order
+enum ButtonId {
+    BUTTON_UP   = 0,
+    BUTTON_DOWN = 1,
+};
+
+enum Gesture {
+    GESTURE_UP_CLICK           = 0,
+    GESTURE_UP_DOUBLE_CLICK    = 1,
+    GESTURE_UP_TRIPLE_CLICK    = 2,
+    GESTURE_DOWN_CLICK         = 3,
+    GESTURE_DOWN_DOUBLE_CLICK  = 4,
+    GESTURE_DOWN_HOLD          = 5,
+    GESTURE_UP_HOLD_DOWN_CLICK = 6, // chord: click Down while holding Up
 };
+#define GESTURE_BIT(gesture) (1UL << (gesture))
+
+// What woke the board, each has its own path through setup()
+enum WakeCause {
+    WAKE_POWER_ON    = 0, // reset, flashing or power applied
+    WAKE_BUTTON_UP   = 1,
+    WAKE_BUTTON_DOWN = 2, // battery level chime, then straight back to sleep
+    WAKE_TIMER       = 3, // pour check
+};
+
+// Boot stages, timestamped for BOOT_PROFILING
+enum BootStage {
+    BOOT_SETUP      = 0, // setup() entered, after ROM, bootloader and app init
+    BOOT_MOTOR      = 1,
+    BOOT_LOADCELL   = 2, // load cell and bean profiles
+    BOOT_INPUT      = 3, // buttons, power management, event loop
+    BOOT_FIRST_DUTY = 4, // first shot started
+    BOOT_STAGE_COUNT
+};
+
+#if HAS_BUTTONBANK
+typedef ButtonBank ButtonInput;
+#else
+typedef ButtonEngine ButtonInput;
+#endif
 
 class Board {
 public:
@@ -30,6 +99,8 @@ public:
     void enterDeepSleep();
     void handleButtonAction();
     void processFeedingCycle();
+    void runSequences();
+    void waitForEvents();
 
 private:
     // GPIO Pins
@@ -51,64 +122,166 @@ private:
     static const adc1_channel_t batteryChannel = ADC1_CHANNEL_2;
     static const adc_unit_t batteryAdcUnit     = ADC_UNIT_1;
 
+    // Deep sleep pin plan, applied at once and held, see applySleepPins()
+    static constexpr SleepPin sleepPins[] = {
+        { IN1_GPIO,               SLEEP_PIN_LOW,     true,               "motor IN1" },   // driver inputs low: outputs off
+        { IN2_GPIO,               SLEEP_PIN_LOW,     true,               "motor IN2" },   // digital only pad, needs the digital hold
+        { HX711CLK_GPIO,          SLEEP_PIN_HIGH,    HAS_LOADCELL,       "HX711 CLK" },   // high for more than 60 us powers the converter down
+        { (gpio_num_t)HX_DOUT,    SLEEP_PIN_ISOLATE, HAS_LOADCELL,       "HX711 DOUT" },
+        { BATTERYPIN_GPIO,        SLEEP_PIN_ISOLATE, HAS_BATTERYMONITOR, "battery" },
+        { BUZZER_GPIO,            SLEEP_PIN_LOW,     HAS_BUZZER,         "buzzer" },
+        { BUTTON_UP_GPIO,         SLEEP_PIN_WAKE,    true,               "button Up" },
+        { BUTTON_DOWN_GPIO,       SLEEP_PIN_WAKE,    true,               "button Down" },
+    };
+    static constexpr int sleepPinCount = sizeof(sleepPins) / sizeof(sleepPins[0]);
+
     // Components
     Motor motor;
     Buzzer buzzer;
     LoadCell loadCell;
     Battery battery;
-    Button buttonUp;
-    Button buttonDown;
+    ButtonInput buttons;
+    GestureRecognizer gestures;
     Speaker* speakerPtr = nullptr;
+    FlowController flowController;
+    BeanProfiles beanProfiles;
+    MotorCharacterizer characterizer;
+    PwmSweep pwmSweep;
+    PulseFeeder pulseFeeder;
+    EventLoop eventLoop;
+    PowerProfile power;
+    BoardStateMachine stateMachine;
+    SafetyCutoff safety;
+    const float safetySimulationRate = 12.0f;       // g/s, SAFETY_SIMULATION: above SafetyCutoff's limit
+    static void onLoadCellSample(void* arg, float weight, int64_t readyTime);
 
-    bool firstUpPress = true;
+    // Startup: serial wait, report, battery measurement, chime
+    class StartupSequence : public Sequence {
+    public:
+        StartupSequence(Board& board) : board(board) {}
+    private:
+        enum { DEFERRED_SETUP, WAIT_SERIAL, REPORT, WAIT_BATTERY, CHIME };
+        Board& board;
+        const unsigned long serialWaitTime = 1500;  // ms for the serial monitor to attach
+        void step() override;
+    };
+
+    // Deep sleep: chime, then the pin plan in one step.
+    // A button before the power down keeps the board awake
+    class SleepSequence : public Sequence {
+    public:
+        SleepSequence(Board& board) : board(board) {}
+        void begin(bool withChime);  // without: straight to the power down
+        bool isCommitted() const;
+    private:
+        enum { STOP, CHIME, CHIME_PLAYING, POWER_DOWN };
+        Board& board;
+        bool withChime = true;
+        const unsigned long brakeTime = 500;        // ms, only when the motor was still running
+        const unsigned long pollInterval = 10;      // ms
+        void step() override;
+    };
+
+    StartupSequence startupSequence;
+    SleepSequence sleepSequence;
+    bool batteryChimePending = false;
+
+    // Fast wake: the Up press that woke the board starts a shot from setup(), serial and
+    // the battery monitor come up afterwards from the startup sequence
+    WakeCause wakeCause = WAKE_POWER_ON;
+    bool wakeShot = false;
+    int64_t bootStamps[BOOT_STAGE_COUNT] = {}; // us since boot, esp_timer
+    bool shouldFeedOnWake() const;
+    WakeCause readWakeCause() const;
+    void chimeBatteryAndSleep();
+    void sleepFromMinimalPath();
+
+    // Pour wake: the deep sleep timer wakes a minimal path that only weighs the hopper
+    const uint64_t pourCheckInterval = 30ULL * 1000000ULL; // us between checks in deep sleep
+    const float pourThreshold = 20.0f;                     // g added since the last check
+    float pouredMass = 0;                                  // g, reported once awake
+    bool checkPour();
+
+    // Hopper check while idle: the converter is off in between, see LoadCell::setConsumer()
+    const unsigned long hopperCheckInterval = 10000;      // ms
+    unsigned long lastHopperCheck = 0;                     // or since the board went idle
+    void updateHopperCheck();
+    void reportHopperCheck();
+    void prepareSleep();
+    void armWakeSources();
+    void stampBoot(BootStage stage);
+    void printBootStages() const;
 
     // Timing tracking
-    unsigned long lastMotorActiveTime = 0;
     unsigned long lastButtonActiveTime = 0;
     
     // loadCell
-    unsigned long delayStartTime = 0;
-    bool waitingAfterClick = false;
+    unsigned long tareStartTime = 0;            // readings are ignored for delayAfterClick from here
     const unsigned long delayAfterClick = 1000;
 
-    // batteryMonitor
-    int batteryLevel;
+    // jam recovery
+    bool jamRecoveryActive = false;
+    float jamProbeWeight = 0;                   // g, at the start of the empty hopper probe
+    const float jamProbeFlatMass = 1.0f;        // g, less moved by the probe means an empty hopper
 
-    // Double click tracking
-    bool pendingClickUp = false;
-    bool pendingClickDown = false;
-	unsigned long clickUpStartTime = 0;
-    unsigned long clickDownStartTime = 0; 
-    const unsigned long doubleClickInterval = 400;
+    // flowControl
+    unsigned long lastFlowTargetUpdate = 0;
+    const unsigned long flowTargetUpdateInterval = 500; // same pace as holding for voltage
+    const float flowTargetStep = 0.1f;                  // g/s per interval when a button is held
+
+    // pulsed feeding
+    const float pulseVoltageBoost = 0.5f;               // V above the min voltage for each pulse
+
+    // batteryMonitor
+    int batteryLevel = BATTERY_HIGH; // until the first measurement
 
     // Config
     const int sleepTimeoutTime = 30000; // inactive time before system goes to sleep
 
-    // Internal callbacks
-    static void onRelease(Button& button);
-    static void onHold(Button& button);
+    // Event loop
+    const unsigned long activeTickInterval = 10;    // ms, loop period while anything is moving
+    const unsigned long loopReportInterval = 10000; // ms, LOOP_PROFILING
+    unsigned long lastLoopReport = 0;
 
     // Buttons
-    void handleUpClick();
-    void handleDoubleClick(Button& button, bool& pendingClick, unsigned long& clickStartTime);
+    void handleUpClick(BoardEvent event=EVENT_START);
+    void startShot(BoardEvent event=EVENT_START);
+    void startSpeculatively();
+    void cancelSpeculativeStart();
+    float getStartVoltage();
+    bool isPulsedFeed();
+    bool isRateControlled();
+    void switchBeanProfile();
+    void startCharacterization();
+    void finishCharacterization();
+    void adjustFlowTarget(float delta);
+    uint32_t enabledGestures();
+    void handleGesture(uint8_t gesture);
+    void handleHolds();
+    void toggleFeedMode();
 
     // Chimes
     void playBatteryLevelChime(Speaker* speaker);
     void playBatteryCriticalChime(Speaker* speaker);
     void playStartupChime(Speaker* speaker);
     void playDeepSleepChime(Speaker* speaker);
+    void playProfileChime(Speaker* speaker);
+    void playCharacterizationChime(Speaker* speaker, bool success);
+    void playFeedModeChime(Speaker* speaker);
     void printWakeupReason() const;
+    void printConfiguration();
+
+    PowerState powerState();
+    unsigned long idleTime();
+    unsigned long nextDeadline(unsigned long tick);
 
     bool shouldStopMotor();
+    bool startJamRecovery();
+    bool probeEmptyHopper();
+    void updateJamRecovery();
+    void reportPostStopMass();
+    void updateFlowControl();
     void resetSystem();
-    
-    // Power saving
-    void configureRtcPin(gpio_num_t pin, 
-                        rtc_gpio_mode_t mode=RTC_GPIO_MODE_DISABLED, 
-                        bool enablePullup=false, 
-                        bool enablePulldown=false);
-    
-    void isolateRtcPin(gpio_num_t pin);
 };
 
 #endif // BOARD_H
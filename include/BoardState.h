@@ -0,0 +1,102 @@
+#ifndef BOARDSTATE_H
+#define BOARDSTATE_H
+
+#include <Arduino.h>
+#include "PowerProfile.h"
+#include "EventLoop.h"
+
+// Parents come before their children, the leaves are the states the board is in
+enum BoardState {
+	STATE_AWAKE          = 0,  // root
+	STATE_READY          = 1,  // motor stopped, a shot may start
+	STATE_IDLE           = 2,
+	STATE_CHIMING        = 3,  // a chime holds the PWM
+	STATE_STOPPING       = 4,  // brake, post-stop mass being measured
+	STATE_SHOT           = 5,  // motor started for a dose
+	STATE_STARTING       = 6,  // started on an Up press, gesture not known yet
+	STATE_TARING         = 7,  // readings ignored while the wheel gets going
+	STATE_FEEDING        = 8,
+	STATE_CHARACTERIZING = 9,
+	STATE_SLEEPING       = 10, // sleep sequence, a button before the power down cancels it
+	STATE_FAULT          = 11, // critical battery: chimes and sleep only
+	STATE_COUNT
+};
+
+enum BoardEvent {
+	EVENT_PRESS_START    = 0,  // Up press, start speculatively
+	EVENT_START          = 1,  // Up gesture or hold, also restarts a running shot
+	EVENT_CANCEL         = 2,  // the press came to nothing
+	EVENT_TARED          = 3,
+	EVENT_STOP           = 4,
+	EVENT_STOPPED        = 5,
+	EVENT_CHIME          = 6,
+	EVENT_CHIME_DONE     = 7,
+	EVENT_CHARACTERIZE   = 8,
+	EVENT_CHARACTERIZED  = 9,
+	EVENT_SLEEP          = 10,
+	EVENT_WAKE           = 11, // sleep cancelled
+	EVENT_BATTERY_CRITICAL = 12,
+	EVENT_COUNT
+};
+
+// What a state needs from the loop while the board is in it
+struct BoardStateConfig {
+	BoardState state;              // same as the index, checked at compile time
+	const char* name;
+	BoardState parent;             // the root is its own parent
+	PowerState power;              // CPU profile while the loop waits
+	unsigned long tickInterval;    // ms, 0: no periodic wake
+	EventBits_t wakeSources;       // LoopEvent bits besides the buttons, which always wake
+	bool sampling;                 // load cell conversions read, the safety cutoff can act
+};
+
+struct BoardTransition {
+	BoardState from;               // the state or any of its children
+	BoardEvent event;
+	BoardState to;                 // a leaf
+};
+
+constexpr bool statesInOrder(const BoardStateConfig* states, int count) {
+	for (int i = 0; i < count; i++) {
+		if (states[i].state != i || states[i].parent > i || (i > 0 && states[i].parent == i)) { return false; }
+	}
+	return true;
+}
+
+// Hierarchical state machine over the tables in Board.cpp. An event takes the first
+// transition whose from is the current state or one of its parents, so e.g. one STOP row
+// on SHOT covers starting, taring and feeding. Events no row matches are ignored, which
+// lets the loop dispatch conditions (chime playing or not) every pass.
+class BoardStateMachine {
+public:
+	static const int maxTransitions = 24;
+
+	BoardStateMachine(const BoardStateConfig* states, const BoardTransition* transitions,
+	                  int transitionCount, BoardState initial);
+
+	void begin();                       // starts the clocks
+	bool dispatch(BoardEvent event);    // true if the state changed
+	BoardState getState() const;
+	const BoardStateConfig& getConfig() const;
+	bool isIn(BoardState state) const;  // the current state or one of its parents
+	unsigned long timeInState() const;  // ms since the current state was entered
+
+	// Profiling: time and entries per state, and how often each transition was taken
+	void report();
+
+private:
+	const BoardStateConfig* states;
+	const BoardTransition* transitions;
+	int transitionCount;
+	BoardState state;
+
+	int64_t enteredAt = 0;              // us, esp_timer
+	int64_t accountedAt = 0;
+	int64_t stateTime[STATE_COUNT] = {};
+	unsigned long entries[STATE_COUNT] = {};
+	unsigned long taken[maxTransitions] = {};
+
+	void account(int64_t now);
+};
+
+#endif
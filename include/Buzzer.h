@@ -2,16 +2,18 @@
 #define BUZZER_H
 
 #include <Arduino.h>
-#include "Speaker.h"  // Base class
+#include "ChimeSequencer.h"  // Base class
 #include "driver/rtc_io.h"
 
-class Buzzer : public Speaker {
+// LEDC tone output, chimes are sequenced from a timer so nothing blocks
+class Buzzer : public ChimeSequencer {
 public:
     Buzzer(int pin, int channel = 0);
     void setup();                    
-    void makeSound(int frequency, int duration) override;
 
 private:
+    void playTone(int frequency) override;
+
     int buzzerPin;
     int buzzerChannel;
 };
@@ -0,0 +1,53 @@
+#ifndef CHIMESEQUENCER_H
+#define CHIMESEQUENCER_H
+
+#include <Arduino.h>
+#include "Speaker.h"
+#include "esp_timer.h"
+
+// Plays queued chimes from an esp_timer, callers return at once.
+// Chimes are constexpr ChimeNote arrays played in place; makeSound() queues a single note.
+// The highest priority chime plays next, equal priorities in call order, and an alert
+// cuts a playing normal chime short (the rest of it is dropped).
+// Subclasses only produce the tone.
+class ChimeSequencer : public Speaker {
+public:
+    void makeSound(int frequency, int duration) override; // queued, returns immediately
+    void play(const ChimeNote* notes, size_t count, ChimePriority priority = CHIME_PRIORITY_NORMAL) override;
+    using Speaker::play;
+    void flush() override;
+    bool isPlaying() const override;
+
+protected:
+    void beginChimes();                      // creates the timer, call from setup()
+    virtual void playTone(int frequency) = 0; // 0 silences; on the caller or the timer task
+
+private:
+    struct Entry {
+        const ChimeNote* notes;              // nullptr: the single note below
+        uint8_t count;
+        ChimePriority priority;
+        uint32_t order;
+        ChimeNote single;
+    };
+    static const int queueSize = 16;
+    Entry queue[queueSize];
+    int queued = 0;
+    uint32_t nextOrder = 0;
+
+    Entry current = {};
+    int noteIndex = 0;                       // next note of current
+    uint16_t pendingGap = 0;                 // ms, after the note that is playing
+    bool preempt = false;                    // drop the rest of current at the next step
+    volatile bool playing = false;           // a timer is armed or a step in flight
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    esp_timer_handle_t timer = nullptr;
+
+    void enqueue(const Entry& entry);
+    bool popHighest();
+    static void onTimer(void* arg);
+    void step();
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "driver/gpio.h"
+#include <atomic>
+
+enum LoopEvent {
+	LOOP_EVENT_BUTTON = 1 << 0,  // button edge or hold timer
+	LOOP_EVENT_SAMPLE = 1 << 1,  // load cell conversion ready
+};
+
+// Blocks the main loop until a button event, a load cell sample or the next deadline,
+// instead of polling. With automatic light sleep configured (see PowerProfile) the idle
+// task sleeps the chip in between, unless a lock of the current power state forbids it.
+class EventLoop {
+public:
+	void setup(bool lightSleepEnabled);
+	// Wakes light sleep, e.g. a button. interruptType is restored after each wake
+	void addWakePin(gpio_num_t pin, int activeLevel, gpio_int_type_t interruptType=GPIO_INTR_ANYEDGE);
+	void setSamplePin(int pin);                       // HX711 DOUT, goes low when data is ready
+
+	// Returns the events that arrived, 0 on timeout. Button wake levels are armed when lightSleep
+	EventBits_t wait(unsigned long timeout, bool lightSleep, bool wantSample);
+
+	static void notify(void* arg);                   // button wake handler, any context
+	static void notifySample(void* arg);             // sample from the load cell acquisition task
+
+	// Profiling: awake time spent running vs blocked and the longest loop pass (stall),
+	// since the last report
+	void report();
+
+private:
+	EventGroupHandle_t events = nullptr;
+	const unsigned long maxTimeout = 60000;        // ms, keeps pdMS_TO_TICKS from overflowing
+	bool lightSleepEnabled = false;
+
+	// Light sleep wakes on levels only, and the level type replaces the pin's edge
+	// interrupt, so wake pins are armed just for idle waits and disarmed by the first wake
+	static const int maxWakePins = 4;
+	gpio_num_t wakePins[maxWakePins];
+	int wakeLevels[maxWakePins];
+	gpio_int_type_t wakeInterruptTypes[maxWakePins];
+	int numWakePins = 0;
+	std::atomic<bool> wakeArmed{false};
+	void armWakePins();
+	void disarmWakePins();
+
+	int samplePin = -1;
+	std::atomic<bool> sampleWanted{false};         // samples outside such waits would only wake the loop
+	static void onSampleReady(void* arg);
+
+	int64_t waitStart = 0;                         // us, esp_timer
+	int64_t runTime = 0;
+	int64_t maxRunTime = 0;
+	int64_t waitTime = 0;
+	unsigned long wakeups = 0;
+};
+
+#endif
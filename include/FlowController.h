@@ -0,0 +1,72 @@
+#ifndef FLOWCONTROLLER_H
+#define FLOWCONTROLLER_H
+
+#include <Arduino.h>
+#include <array>
+
+using namespace std;
+
+extern RTC_DATA_ATTR float rtcDeadTime;
+
+// Closed-loop feed rate control with a Smith predictor.
+// The plant (feed speed in % -> feed rate in g/s, see SpeedMap) is modelled as first order plus dead time:
+// beans need time to travel off the wheel and the load cell averages/smooths the signal.
+// The PI acts on the undelayed model output corrected by the model error, so the
+// dead time is kept out of the feedback loop.
+class FlowController {
+public:
+	FlowController(float minDrive, float maxDrive);
+
+	void reset(float drive, unsigned long now);
+	float update(float measuredRate, unsigned long now);    // returns new motor feed speed
+	void setTarget(float rate);
+	float getTarget() const;
+	float getDeadTime() const;
+	void setGain(float newGain);              // g/s per %, e.g. from a learned flow curve
+
+	// Dead time identification from shot history.
+	// record() takes the drive applied over the interval ending at this sample.
+	void record(float drive, float measuredRate, unsigned long now);
+	void identifyDeadTime();
+
+private:
+	float minDrive;                         // also the model origin: no flow below it
+	float maxDrive;
+
+	// Plant model
+	float gain = 0.025f;                    // g/s per % feed speed
+	const float timeConstant = 1.2f;        // s, includes load cell rate smoothing
+	const float defaultDeadTime = 1.5f;     // s, used until a shot has been identified
+	const float maxDeadTime = 6.0f;         // s
+
+	// Controller tuning (IMC): closed loop time constant
+	const float closedLoopTime = 1.0f;      // s, smaller = tighter response
+
+	float targetRate = 0.6f;                // g/s
+	const float minTargetRate = 0.1f;       // g/s
+	const float minGain = 0.001f;           // g/s per %
+	float drive = 0;
+	float integral = 0;
+	float modelRate = 0;                    // undelayed model output
+	unsigned long lastUpdateTime = 0;
+
+	// Undelayed model output history, used to delay the model by the dead time
+	static const int modelHistorySize = 32;
+	array<float, modelHistorySize> modelHistory;
+	array<unsigned long, modelHistorySize> modelHistoryTime;
+	int modelInd = 0;
+	int modelObsCnt = 0;
+	float delayedModelRate(unsigned long now) const;
+
+	// Shot history for dead time identification
+	static const int shotHistorySize = 120;  // 60s at the load cell sample interval
+	array<float, shotHistorySize> driveHistory;
+	array<float, shotHistorySize> rateHistory;
+	unsigned long firstRecordTime = 0;
+	unsigned long lastRecordTime = 0;
+	int shotObsCnt = 0;
+	const float minCorrelation = 0.4f;      // normalised cross correlation needed to trust a lag
+	const float learningRate = 0.3f;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef FLOWMODEL_H
+#define FLOWMODEL_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <array>
+
+using namespace std;
+
+// Learned voltage -> steady state feed rate curve.
+// Rates are binned by motor voltage and exponentially smoothed per bin; lookups
+// interpolate between learned bins on a monotonic envelope.
+class FlowModel {
+public:
+	void reset();
+	void beginShot(unsigned long now);
+	void observe(float voltage, float rate, unsigned long now, float deadTime);
+	void endShot();                          // drops samples taken while the hopper ran empty
+
+	float voltageForRate(float rate) const;  // V, -1 if the curve does not cover the rate
+	float rateAt(float voltage) const;       // g/s on the envelope, -1 outside the learned bins
+	float getSteadyRate() const;             // last steady rate of this shot, -1 if none
+	bool isModified() const;
+
+	bool load(Preferences& prefs, const char* key);
+	void save(Preferences& prefs, const char* key);
+
+private:
+	static const int numBins = 19;
+	const float binMinVoltage = 1.5f;        // V, covers 1kHz and 20kHz PWM min voltages
+	const float binWidth = 0.1f;             // V
+
+	// Stored as one blob per profile
+	struct Curve {
+		uint16_t version;
+		array<float, numBins> rate;          // g/s
+		array<uint16_t, numBins> count;      // samples seen per bin
+	};
+	static const uint16_t curveVersion = 1;
+	Curve curve;
+
+	const float learningRate = 0.2f;         // per sample EMA once a bin is established
+	const uint16_t maxCount = 1000;
+	const float voltageEpsilon = 0.01f;
+	const float settleTimeConstants = 3.0f;  // time constants to wait after a voltage change
+	const float timeConstant = 1.2f;         // s, see FlowController
+
+	// Steady samples are held back until they are older than the tail guard,
+	// so the falling rate of an emptying hopper never reaches the curve
+	struct Sample {
+		int bin;
+		float rate;
+		unsigned long time;
+	};
+	static const int pendingSize = 16;
+	array<Sample, pendingSize> pending;
+	int pendingHead = 0;
+	int pendingCnt = 0;
+	const unsigned long tailGuardTime = 5000;   // ms, longer than the load cell stop detection
+	void commit(const Sample& sample);
+
+	float lastVoltage = -1.0f;
+	unsigned long voltageChangeTime = 0;
+	float steadyRate = -1.0f;
+	bool modified = false;
+
+	int binIndex(float voltage) const;
+	float binVoltage(int ind) const;
+};
+
+#endif
@@ -3,19 +3,78 @@
 
 #include <Arduino.h>
 #include "HX711.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <array>
+#include <atomic>
+#include "Sequence.h"
 
 using namespace std;
 
+extern RTC_DATA_ATTR float rtcEmptyWeight;
+extern RTC_DATA_ATTR bool rtcEmptyWeightKnown;
+
+// Who needs conversions, the converter is powered while any of them does
+enum SampleConsumer {
+	SAMPLES_BOARD        = 1 << 0, // the board state reads the load cell: shot, post-stop, characterisation
+	SAMPLES_HOPPER_CHECK = 1 << 1, // duty cycled check while idle
+};
+
+// Called in the acquisition task for every conversion, readyTime: esp_timer us when DOUT went low
+typedef void (*SampleListener)(void* arg, float weight, int64_t readyTime);
+
 class LoadCell {
 public:
 	LoadCell(int doutPin, int clkPin, float calibrationFactor, float alpha = 0.3);
 
+	LoadCell(const LoadCell&) = delete;      // the hopper check refers back to this load cell
+
 	void setup();
-	void update();               
+	bool update();               // returns true when a new feed rate sample is available
 	void reset();
 	bool shouldStop();        
+	float getFeedRate() const;   // g/s
+	float getWeight() const;     // g, absolute, last averaged reading
+	bool hasSettledWeight() const; // the shot has taken its first settled reading
+	bool isFlowing() const;
+	void restartStopDetection(); // keeps the tare, forgets the stop windows
+
+	// Hopper contents, relative to the learned empty hopper weight
+	bool knowsEmptyWeight() const;
+	float getRemainingMass() const;
+	bool hasMassRemaining() const; // true while unknown, so a jam is never mistaken for an empty hopper
+	void learnEmptyWeight();
+
+	// Beans delivered after the stop decision (overshoot)
+	void beginPostStop();        // call at the stop decision, before reset()
+	bool updatePostStop();       // true once the measurement is done
+	bool isMeasuringPostStop() const;
+	float getPostStopMass() const;
 	bool nonBlockingReadWeight();
+	bool readSample(float& weight);  // single reading if the converter is ready, never waits
+
+	// Acquisition task: reads each conversion as DOUT goes low, hands it to the listener and
+	// queues it for the loop, so the loop never waits on the HX711. Without it the loop reads directly
+	void startAcquisition(SampleListener listener, void* arg);
+	void setSimulatedFeed(float rate);   // test builds: a hopper losing rate g/s replaces the HX711
+
+	// Converter power: on while any consumer wants samples, CLK high powers it down otherwise.
+	// Conversions before the output settled after a power up are dropped
+	void setConsumer(SampleConsumer consumer, bool wanted);
+	bool isSettled() const;              // powered for settleTime, conversions are weights
+	void report();                       // converter on-time this awake session
+
+	// Hopper check while idle: powers the converter for one settled reading, without blocking
+	void startHopperCheck();
+	void cancelHopperCheck();
+	bool updateHopperCheck();            // true when a check finished on this call
+	bool isCheckingHopper() const;
+	unsigned long timeToNextStep() const; // ms until the check wants to run again
+	bool getHopperWeight(float& weight) const; // absolute g, false if the last check got no reading
+	bool hasBeans() const;               // last check above the empty hopper, true while unknown
+
+	// Minimal wake path: powers the converter up and waits out its settling, blocking
+	bool measureAfterPowerUp(float& weight);
 
 private:
 	HX711 scale;
@@ -28,6 +87,54 @@ private:
 
 	// Weight tracking
 	float previousWeight = 0;
+	float tareWeight = 0;
+	float currentWeight = 0;     // absolute, scale offset stays 0
+	const float minRemainingMass = 3.0f;
+	const float emptyWeightLearningRate = 0.3f;
+
+	// Post-stop measurement
+	bool postStopActive = false;
+	unsigned long postStopStart = 0;
+	float postStopWeight = 0;
+	float postStopMass = 0;
+	const unsigned long postStopSettleTime = 2000; // ms for the wheel and load cell to settle
+
+	// Power up measurement
+	const unsigned long powerUpTimeout = 1000;     // ms, settling takes 400 ms at 10 SPS
+	const int powerUpReadings = 3;
+
+	// Converter power, switched by the acquisition task when there is one, else by the loop
+	std::atomic<uint8_t> consumers{0};
+	bool powered = true;                           // CLK is low from setup()
+	const unsigned long settleTime = 400;          // ms after power up, HX711 output settling at 10 SPS
+	int64_t poweredAt = 0;                         // us, esp_timer; with settledAt and onTime guarded by sampleMux
+	int64_t settledAt = 0;                         // 0 while powered down
+	int64_t onTime = 0;                            // us powered this awake session, up to poweredAt
+	unsigned long powerUps = 0;
+	unsigned long unsettledSamples = 0;            // conversions dropped while settling
+	void applyPower(bool on);
+	bool settledBy(int64_t time) const;
+
+	// Hopper check: hopperReadings settled conversions averaged, then powered down again
+	class HopperCheck : public Sequence {
+	public:
+		HopperCheck(LoadCell& cell) : cell(cell) {}
+		void begin();
+	private:
+		enum { SETTLE, READ };
+		LoadCell& cell;
+		int readings = 0;
+		float sum = 0.0f;
+		unsigned long readStart = 0;
+		void step() override;
+	};
+	HopperCheck hopperCheck{*this};
+	const int hopperReadings = 3;
+	const unsigned long hopperReadTimeout = 1000;  // ms after settling, then the check gives up
+	const unsigned long hopperPollInterval = 100;  // ms, one conversion at 10 SPS
+	float hopperWeight = 0;
+	bool hopperWeightKnown = false;
+	unsigned long hopperChecks = 0;
 
 	// Feed rate
 	float currRate = 0;
@@ -62,7 +169,36 @@ private:
 	int cnt = 0;
 	float tallySum = 0.0f;
 	float avgWeight = 0.0f;
+	bool batchOpen = false;      // queued conversions were dropped for the running average
 	void start(unsigned long now);
+
+	// Acquisition
+	TaskHandle_t acquisitionTask = nullptr;
+	SampleListener listener = nullptr;
+	void* listenerArg = nullptr;
+	volatile int64_t sampleReadyTime = 0;
+	const UBaseType_t acquisitionPriority = configMAX_PRIORITIES - 2; // above the loop and the esp_timer task
+	const uint32_t acquisitionStackSize = 3072;
+	const unsigned long acquisitionTimeout = 250; // ms, re-checks DOUT in case an edge was missed
+	static const int sampleQueueSize = 16;
+	float sampleQueue[sampleQueueSize];
+	int sampleHead = 0;
+	int sampleCount = 0;
+	mutable portMUX_TYPE sampleMux = portMUX_INITIALIZER_UNLOCKED;
+
+	float simulatedRate = 0;     // g/s, 0: the HX711
+	int64_t simulationStart = 0;
+	const float simulatedStartMass = 300.0f;
+	const unsigned long simulatedSamplePeriod = 100; // ms, 10 SPS like the HX711
+
+	static void acquisitionEntry(void* arg);
+	static void onDataReady(void* arg);
+	void acquisitionLoop();
+	bool acquire(float& weight, int64_t& readyTime);
+	void pushSample(float weight);
+	bool popSample(float& weight);
+	void discardSamples();
+	bool takeSample(float& weight);
 	// bool started() const;
 };
 
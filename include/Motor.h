@@ -2,25 +2,75 @@
 #define MOTOR_H
 
 #include <Arduino.h>
-#include "Speaker.h"
+#include "ChimeSequencer.h"
+#include "SpeedMap.h"
+#include <Preferences.h>
+#include "esp_timer.h"
+#include <atomic>
 #include "driver/rtc_io.h"
 
 extern RTC_DATA_ATTR float rtcMotorVoltage;
+extern RTC_DATA_ATTR unsigned int rtcJamCount;
+extern RTC_DATA_ATTR unsigned int rtcJamClearedCount;
 
-class Motor : public Speaker {
+enum StopMode {
+    STOP_COAST = 0,  // both inputs low, the wheel runs down
+    STOP_BRAKE = 1,  // both inputs high for brakeTime, then coast
+};
+
+enum RecoveryPhase {
+    RECOVERY_IDLE    = 0,
+    RECOVERY_REVERSE = 1,
+    RECOVERY_FORWARD = 2,
+};
+
+class Motor : public ChimeSequencer {
 public:
 	Motor(int pwmPin, int directionPin);
 
     void setup();
     void reset();
-    void makeSound(int frequency, int duration) override;
+    void update();
     float getVoltage() const;
     float getMinVoltage() const;
     float getMaxVoltage() const;
-    float getVoltageStep() const;
     void setVoltage(float newVoltage, bool forceSet=false);
+    void setSpeed(float newSpeed, bool forceSet=false); // 0-100 % feed speed, linear in flow
+    float getSpeed() const;
+    float getSpeedStep() const;
+    float getRatePerSpeed() const;                      // g/s per %, -1 until a flow curve is learned
+    bool calibrateSpeed(const FlowModel& model);
+    void setSupplyVoltage(float voltage);
     void setMotorStartTime();
     bool shouldStop() const;
+    StopMode getStopMode() const;
+    bool isActive() const;           // running, braking, kicking or playing a note: PWM must keep going
+
+    // Pulsed feeding: on/off pulses at pulseVoltage, timed by esp_timer
+    void startPulsing(float pulseVoltage, unsigned long period, float onFraction);
+    void setPulse(unsigned long period, float onFraction); // applies from the next edge
+    void stopPulsing();
+    bool isPulsing() const;
+
+    // Measured stiction, persisted in NVS
+    void applyCharacterization(float breakaway, float keepRunning);
+    void applyPwmFrequency(int frequency);
+    void setPwmFrequency(int frequency); // not persisted, for sweeps
+    int getPwmFrequency() const;
+    void setKickEnabled(bool enabled);
+
+    // Jam recovery: reverse pulses on IN2, then forward again
+    bool startRecovery();            // false once the retry limit is reached
+    bool isRecovering() const;
+    int getRecoveryAttempts() const; // attempts on the current jam
+    void recoveryCleared();
+    void report();                   // jam recovery this awake session
+
+    // Safety cutoff: both H-bridge inputs leave the LEDC and go low, from any task.
+    // Nothing the loop, the pulse timer or a chime writes reaches the pins until cleared
+    void cutoff();
+    void clearCutoff();              // after reset(), gives the pins back to the LEDC
+    bool isCutOff() const;
 
 private:
     int pwmPin;
@@ -33,11 +83,75 @@ private:
 	unsigned long lastMotorUpdate = 0;
 	const unsigned long motorUpdateInterval = 500; //milliseconds, controls how frequently the motor voltage gets updated
 
-    float motorVoltage;
+    float motorVoltage = 0;
 	float motorMinVoltage = 2.5; //voltage the system will default to when clicking or holding up. Use 1.5V for 1000Hz analog freq, 2.7 for 20000Hz.
-	float motorMaxVoltage = 3.3; //PWM Logic Level
-	float motorVoltageStep = 0.2; //voltage the motor will step up per MotorUpdateTime interval when a button is held  Use 0.2 for 1000Hz, 0.1 for 20000Hz
-	int motorPWMFrequency = 20000; //motor PWM frequency, 20000 you can't hear, 1000 has more granular range.
+	float motorMaxVoltage = 3.3; //PWM Logic Level, or the highest motor voltage when the supply voltage is known
+	float supplyVoltage = 3.3; //driver supply, defaults to motorMaxVoltage so full duty = max voltage
+	const float supplyVoltageEpsilon = 0.02; //re-apply duty when the supply moved more than this
+	const float minSupplyVoltage = 2.5; //ignore implausible readings
+	SpeedMap speedMap;
+	float motorSpeed = 0; //feed speed in % matching motorVoltage
+	const float motorSpeedStep = 5; //feed speed the motor will step up per MotorUpdateTime interval when a button is held
+	int motorPWMFrequency = 20000; //motor PWM frequency, 20000 you can't hear, 1000 has more granular range. Replaced by a PWM sweep result from NVS
+
+	Preferences prefs;
+	const float minVoltageMargin = 0.1; //added to the measured keep running voltage
+
+	// Start kick: starts below the measured breakaway voltage get a short pulse at it
+	float breakawayVoltage = -1.0; //-1 until characterised
+	bool kickEnabled = true;
+	bool kicking = false;
+	unsigned long kickStartTime = 0;
+	const unsigned long kickTime = 150; //milliseconds
+
+	// Pulsed feeding
+	esp_timer_handle_t pulseTimer = nullptr;
+	std::atomic<bool> pulseActive{false};
+	std::atomic<bool> pulseBusy{false};   //edge callback in flight on the timer task
+	const int maxHaltYields = 100;        //bound on waiting out an edge in flight
+	volatile bool pulseOn = false;
+	float pulseVoltage = 0;
+	volatile unsigned long pulsePeriod = 1000; //milliseconds
+	volatile float pulseOnFraction = 0.5;
+	static void onPulseTimer(void* arg);
+	void pulseEdge();
+	void haltPulseTimer();
+
+	// Sound: the PWM carrier is moved to the note frequency at unchanged duty,
+	// so a running motor keeps its mean voltage and feed while it sings
+	const float idleSoundVoltage = 0.3; //drive used for notes while the motor is stopped
+	void playTone(int frequency) override;
+	void setCarrierFrequency(int frequency);
+
+	// Stopping
+	StopMode stopMode = STOP_BRAKE; //STOP_COAST to compare post-stop mass
+	const unsigned long brakeTime = 200; //milliseconds of short brake before coasting
+	bool braking = false;
+	unsigned long brakeStartTime = 0;
+	void endBrake();
+
+	// Jam recovery
+	std::atomic<RecoveryPhase> recoveryPhase{RECOVERY_IDLE};  //read by the pulse edge on the timer task
+	unsigned long recoveryPhaseStart = 0;
+	int recoveryPulse = 0;
+	int recoveryAttempts = 0;
+	const int recoveryPulses = 3; //reverse/forward pulse pairs per attempt
+	const int maxRecoveryAttempts = 3; //attempts per jam before giving up
+	const unsigned long reversePulseTime = 150; //milliseconds
+	const unsigned long forwardPulseTime = 300; //milliseconds
+	const float recoveryVoltage = 3.3; //pulses at full speed to break the bridge
+	unsigned long recoveryAttemptCount = 0; //this awake session, for report()
+	unsigned long recoveryGiveUps = 0;
+
+	// Safety cutoff
+	std::atomic<bool> cutOff{false};
+
+	int voltageToDuty(float voltage) const;
+	float voltageToSpeed(float voltage) const;
+	bool applyVoltage(float newVoltage, bool forceSet);
+	bool outputOverridden() const; //brake, kick or recovery currently drive the pins
+	void loadCharacterization();
+	void beginRecoveryPhase(RecoveryPhase phase);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef MOTORCHARACTERIZER_H
+#define MOTORCHARACTERIZER_H
+
+#include <Arduino.h>
+#include <array>
+#include "Motor.h"
+#include "LoadCell.h"
+
+using namespace std;
+
+enum CharacterizerPhase {
+	CHAR_IDLE      = 0,
+	CHAR_BASELINE  = 1,  // motor off, learn the load cell noise floor
+	CHAR_RAMP_UP   = 2,  // find the breakaway voltage
+	CHAR_RAMP_DOWN = 3,  // find the lowest voltage that keeps it running
+	CHAR_DONE      = 4,
+	CHAR_FAILED    = 5,
+};
+
+// Non-blocking motor self characterisation.
+// Ramps the motor from standstill and detects motion from the load cell, either as
+// flow (weight slope) or as the vibration the running wheel adds to the readings.
+class MotorCharacterizer {
+public:
+	MotorCharacterizer(Motor& motor, LoadCell& loadCell);
+
+	void start();
+	bool update();                          // true while running
+	void abort();
+	bool isRunning() const;
+	bool succeeded() const;
+	float getBreakawayVoltage() const;
+	float getKeepRunningVoltage() const;
+
+	// Per step results of the last run
+	int getStepCount() const;
+	float getStepVoltage(int ind) const;
+	float getStepRate(int ind) const;       // g/s
+	float getStepNoise(int ind) const;      // g
+
+private:
+	Motor& motor;
+	LoadCell& loadCell;
+
+	CharacterizerPhase phase = CHAR_IDLE;
+	float voltage = 0;
+	float breakawayVoltage = -1.0f;
+	float keepRunningVoltage = -1.0f;
+	float baselineNoise = 0;
+
+	// Ramp
+	const float rampStartVoltage = 1.0f;    // V, well below any stall voltage seen so far
+	const float rampStep = 0.1f;            // V
+	const unsigned long stepSettleTime = 500;   // ms ignored after each voltage change
+	const unsigned long stepDwellTime = 2000;   // ms per step including settling
+	unsigned long stepStartTime = 0;
+
+	// Motion detection
+	const float minFlowRate = 0.15f;        // g/s
+	const float vibrationFactor = 3.0f;     // noise above baseline * factor counts as running
+	const float minNoiseDelta = 0.05f;      // g, floor for a very quiet baseline
+
+	// Running statistics of the current step
+	int n = 0;
+	float sumT = 0, sumW = 0, sumTT = 0, sumTW = 0;
+	float sumDiffSq = 0;
+	float prevWeight = 0;
+
+	// Results per step
+	static const int maxSteps = 48;
+	array<float, maxSteps> stepVoltage;
+	array<float, maxSteps> stepRate;
+	array<float, maxSteps> stepNoise;
+	int stepCnt = 0;
+
+	void beginStep(CharacterizerPhase newPhase, float newVoltage);
+	void addReading(float weight, unsigned long now);
+	bool finishStep(float& rate, float& noise);
+	bool isMoving(float rate, float noise) const;
+	void finish(CharacterizerPhase result);
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef POWERPROFILE_H
+#define POWERPROFILE_H
+
+#include <Arduino.h>
+#include "esp_pm.h"
+
+enum PowerState {
+	POWER_IDLE           = 0, // blocked until a button or the sleep timeout
+	POWER_WAITING        = 1, // loop ticking for a gesture, debounce or post-stop reading, nothing driven
+	POWER_FEEDING        = 2,
+	POWER_CHIME          = 3, // motor notes or the brake after a stop
+	POWER_CHARACTERIZING = 4,
+	POWER_STATE_COUNT
+};
+
+enum PowerLevel {
+	POWER_LEVEL_MIN = 0,      // minimum frequency, or light sleep where the state allows it
+	POWER_LEVEL_APB = 1,      // 80 MHz APB: LEDC PWM and esp_timer clocks unchanged
+	POWER_LEVEL_MAX = 2,      // f_cpu, whenever a task runs
+	POWER_LEVEL_COUNT
+};
+
+struct PowerStateConfig {
+	const char* name;
+	PowerLevel level;         // level while the loop waits
+	bool lightSleep;          // light sleep allowed between events
+};
+
+// ESP-IDF power management locks held per Board state, from a table.
+// ESP-IDF keeps the CPU at f_cpu whenever a task runs, so filtering and control get full
+// speed with no switching on the control path; the table only decides what the chip
+// drops to while the loop waits: minFrequency, 80 MHz APB for peripherals, or light sleep.
+// Needs CONFIG_PM_ENABLE; without it the locks are no-ops and everything runs at f_cpu.
+class PowerProfile {
+public:
+	void setup();
+	void printConfiguration() const;
+	void setState(PowerState state);
+	PowerState getState() const;
+	bool allowsLightSleep() const;
+	bool isLightSleepEnabled() const;   // configured, not just allowed by the state
+
+	void beginWait();                   // around the loop's blocking wait, for the counters
+	void endWait();
+
+	void report();                      // time per frequency level and state since setup
+
+private:
+	const int minFrequency = 40;        // MHz, XTAL
+	int maxFrequency = 240;             // MHz, f_cpu at setup
+
+	esp_pm_lock_handle_t cpuMaxLock = nullptr;
+	esp_pm_lock_handle_t apbMaxLock = nullptr;
+	esp_pm_lock_handle_t noSleepLock = nullptr;
+	bool scalingEnabled = false;
+	bool lightSleepEnabled = false;
+
+	PowerState state = POWER_IDLE;
+	bool waiting = false;
+
+	// us, esp_timer
+	int64_t lastAccountTime = 0;
+	int64_t levelTime[POWER_LEVEL_COUNT] = {};
+	int64_t stateTime[POWER_STATE_COUNT] = {};
+
+	PowerLevel currentLevel() const;
+	void account();
+	void applyLocks(const PowerStateConfig& from, const PowerStateConfig& to);
+	static void setLock(esp_pm_lock_handle_t lock, bool held, bool wasHeld);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef PULSEFEEDER_H
+#define PULSEFEEDER_H
+
+#include <Arduino.h>
+#include "Motor.h"
+
+// Pulsed feeding for beans that clump at constant low speed.
+// The motor runs on/off pulses at a higher voltage; the on fraction is integrated
+// towards the target feed rate and the period follows so each pulse stays long
+// enough to break away and move a full pocket.
+class PulseFeeder {
+public:
+	PulseFeeder(Motor& motor);
+
+	void start(float pulseVoltage, unsigned long now);
+	void update(float targetRate, float measuredRate, unsigned long now);
+
+private:
+	Motor& motor;
+
+	float onFraction = 0.5f;
+	unsigned long period = 1000;                // ms
+	unsigned long lastUpdateTime = 0;
+
+	const float initialOnFraction = 0.5f;
+	const float maxOnFraction = 0.9f;
+	const float fractionGain = 0.1f;            // on fraction per g/s of error per second
+	const unsigned long minOnTime = 250;        // ms
+	const unsigned long minPeriod = 500;        // ms
+	const unsigned long maxPeriod = 2000;       // ms, keeps flow steady for the load cell stop detection
+	const float minOnFraction = (float)minOnTime / maxPeriod;  // below this a pulse at maxPeriod is shorter than minOnTime
+
+	unsigned long periodFor(float fraction) const;
+};
+
+#endif
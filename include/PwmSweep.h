@@ -0,0 +1,47 @@
+#ifndef PWMSWEEP_H
+#define PWMSWEEP_H
+
+#include <Arduino.h>
+#include "Motor.h"
+#include "MotorCharacterizer.h"
+
+// Non-blocking PWM frequency sweep.
+// Runs the motor characterisation (duty ramp up and down) at each candidate frequency and
+// picks the one with the lowest keep running voltage above the audible limit: the lower the
+// motor can run without stalling, the finer the low speed control.
+// Every step is dumped over serial as CSV for analysis.
+class PwmSweep {
+public:
+	PwmSweep(Motor& motor, MotorCharacterizer& characterizer);
+
+	void start();
+	bool update();                          // true while running
+	void abort();
+	bool succeeded() const;
+	int getBestFrequency() const;           // Hz, -1 until a sweep succeeded
+	float getBreakawayVoltage() const;      // measured at the best frequency
+	float getKeepRunningVoltage() const;
+
+private:
+	Motor& motor;
+	MotorCharacterizer& characterizer;
+
+	static const int numFrequencies = 6;
+	static const int frequencies[numFrequencies];  // Hz, ascending
+	const int minQuietFrequency = 16000;    // Hz, lower frequencies whine at low duty
+	const float tolerance = 0.05f;          // V, half a characterisation ramp step
+
+	bool running = false;
+	int freqInd = 0;
+	int initialFrequency = 0;
+	int bestFrequency = -1;
+	float bestBreakaway = -1.0f;
+	float bestKeepRunning = -1.0f;
+
+	void startFrequency();
+	void dumpRun() const;
+	bool isBetter(float breakaway, float keepRunning) const;
+	void finish();
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SAFETYCUTOFF_H
+#define SAFETYCUTOFF_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "Motor.h"
+
+enum SafetyTrip {
+	SAFETY_OK         = 0,
+	SAFETY_MAX_DOSE   = 1, // more dispensed in one shot than any dose
+	SAFETY_OVER_RANGE = 2, // reading beyond the load cell: sensor fault or a hand on the hopper
+	SAFETY_RUNAWAY    = 3, // feed rate far above anything the motor should deliver
+};
+
+// Overfeed protection that does not depend on the main loop. check() runs in the load cell
+// acquisition task for every conversion, so a trip cuts the motor within one sample period
+// however long the loop is stalled by a chime, serial output or a blocking read. The loop
+// only learns about it afterwards, stops the shot and acknowledges.
+class SafetyCutoff {
+public:
+	SafetyCutoff(Motor& motor);
+
+	void arm();                                   // loop: the next sample is the shot baseline
+	void disarm();
+	void check(float weight, int64_t readyTime);  // acquisition task, readyTime: esp_timer us at DOUT low
+
+	bool hasTripped() const;
+	void acknowledge();                           // loop, once the shot is stopped: logs the trip
+
+	void report();                                // worst sample-to-decision latency and trips since setup
+
+private:
+	Motor& motor;
+
+	const float maxDoseMass = 80.0f;              // g dispensed since the shot started
+	const float maxMeasuredMass = 2000.0f;        // g either way, past the load cell range
+	const float maxFeedRate = 8.0f;               // g/s across the slope window
+	static const int slopeWindow = 5;             // samples, about 0.5 s at 10 SPS
+
+	std::atomic<bool> armed{false};
+	std::atomic<bool> rearm{false};               // the task takes a new baseline
+	std::atomic<bool> tripped{false};
+
+	// acquisition task only
+	float baseline = 0;
+	float window[slopeWindow] = {};
+	int64_t windowTime[slopeWindow] = {};
+	int windowIndex = 0;
+	int windowCount = 0;
+	SafetyTrip trip = SAFETY_OK;
+	float tripValue = 0;                          // g or g/s, whatever crossed the limit
+	int64_t tripLatency = 0;                      // us from DOUT low to the pins released
+	int64_t maxCheckLatency = 0;                  // us from DOUT low to the decision, every sample
+	unsigned long checks = 0;
+	unsigned long trips = 0;
+
+	void cutoff(SafetyTrip reason, float value, int64_t readyTime);
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <Arduino.h>
+#include <limits.h>
+
+// Cooperative resumable sequence, for work that used to be a chain of delay() calls.
+// A subclass keeps its progress in phase and returns from step() wherever it would have
+// waited; the loop calls update() again once the wait is over, and services buttons and
+// sensors in between. Sequences are plain members, nothing is allocated.
+class Sequence {
+public:
+	virtual ~Sequence() {}
+
+	void start();                        // from phase 0, restarts a running sequence
+	void cancel();
+	bool isRunning() const;
+	bool update();                       // runs the step if it is due, false once finished
+	unsigned long timeToNextStep() const; // ms, ULONG_MAX when not running
+
+protected:
+	int phase = 0;
+
+	virtual void step() = 0;             // ends with waitFor(), next() or finish()
+	void waitFor(unsigned long duration, int nextPhase);
+	void next(int nextPhase);            // continue without waiting
+	void finish();
+
+private:
+	bool running = false;
+	unsigned long stepTime = 0;          // millis() the next step is due
+};
+
+#endif
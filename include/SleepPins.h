@@ -0,0 +1,33 @@
+#ifndef SLEEPPINS_H
+#define SLEEPPINS_H
+
+#include <Arduino.h>
+#include "driver/gpio.h"
+
+enum SleepPinMode {
+	SLEEP_PIN_ISOLATE = 0, // input, output and pulls off, held
+	SLEEP_PIN_LOW     = 1, // driven low, held
+	SLEEP_PIN_HIGH    = 2, // driven high, held
+	SLEEP_PIN_WAKE    = 3, // RTC input with pulldown, an EXT1 wake source, not held
+};
+
+// One row of a board's deep sleep pin plan
+struct SleepPin {
+	gpio_num_t pin;
+	SleepPinMode mode;
+	bool present;          // the peripheral is fitted, absent rows are skipped
+	const char* name;
+};
+
+// The whole plan is applied in one pass and held, digital only pads included, so nothing
+// depends on the order pins are released in.
+void applySleepPins(const SleepPin* pins, int count, esp_err_t* results=nullptr);
+uint64_t sleepWakeMask(const SleepPin* pins, int count);
+// After a wake, before any component touches its pins: every row keeps its sleep state, released
+void releaseSleepPins(const SleepPin* pins, int count);
+
+// Reads the pads back and compares them to the plan, and lists GPIO outputs the plan does
+// not cover. Expects the results of applySleepPins(). False if anything leaks
+bool auditSleepPins(const SleepPin* pins, int count, const esp_err_t* results);
+
+#endif
@@ -2,10 +2,39 @@
 #ifndef SPEAKER_H
 #define SPEAKER_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+struct ChimeNote {
+    uint16_t frequency;           // Hz, 0 is a rest
+    uint16_t duration;            // ms
+    uint16_t gap;                 // ms of silence after the note
+};
+
+enum ChimePriority {
+    CHIME_PRIORITY_NORMAL = 0,
+    CHIME_PRIORITY_ALERT  = 1,    // cuts a playing normal chime short
+};
+
 class Speaker {
 public:
-    virtual void makeSound(int frequency, int duration) = 0; // Pure virtual function
+    virtual void makeSound(int frequency, int duration) = 0; // Pure virtual function, frequency 0 is a rest
+    virtual void flush() {}       // blocks until queued sounds have played
+    virtual bool isPlaying() const { return false; } // queued sounds left, for waiting without blocking
+
+    // A whole chime; speakers without a queue play it note by note
+    virtual void play(const ChimeNote* notes, size_t count, ChimePriority priority = CHIME_PRIORITY_NORMAL) {
+        for (size_t i = 0; i < count; i++) {
+            makeSound(notes[i].frequency, notes[i].duration);
+            if (notes[i].gap > 0) { makeSound(0, notes[i].gap); }
+        }
+    }
+    template <size_t N>
+    void play(const ChimeNote (&notes)[N], ChimePriority priority = CHIME_PRIORITY_NORMAL) {
+        play(notes, N, priority);
+    }
+
     virtual ~Speaker() {}         
 };
 
-#endif
\ No newline at end of file
+#endif
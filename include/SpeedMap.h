@@ -0,0 +1,43 @@
+#ifndef SPEEDMAP_H
+#define SPEEDMAP_H
+
+#include <Arduino.h>
+#include <array>
+#include "FlowModel.h"
+
+using namespace std;
+
+static const int numSpeeds = 101;         // 0..100 % feed speed
+static const int speedCurveExponent = 2;  // drive ~ speed^2, i.e. flow ~ sqrt(drive above stall)
+
+// Default curve, built at compile time: flow rises steeply just above stall and flattens
+// towards full drive, so the drive for evenly spaced flow grows with the square of the speed.
+// Entries are the fraction of the min..max voltage span.
+constexpr array<float, numSpeeds> makeSpeedTable() {
+	array<float, numSpeeds> table = {};
+	for (int i = 0; i < numSpeeds; ++i) {
+		float x = i / float(numSpeeds - 1);
+		float drive = 1.0f;
+		for (int p = 0; p < speedCurveExponent; ++p) { drive *= x; }
+		table[i] = drive;
+	}
+	return table;
+}
+
+// Linear feed speed (0 % = min voltage, 100 % = max voltage) -> fraction of the voltage span.
+// A learned flow curve can replace the default table at runtime.
+class SpeedMap {
+public:
+	float toDrive(int speed) const { return table[speed]; }
+	int fromDrive(float fraction) const;    // nearest speed
+	bool calibrate(const FlowModel& model, float minVoltage, float maxVoltage);
+	float getRatePerSpeed() const;          // g/s per %, -1 on the default table
+
+private:
+	static constexpr array<float, numSpeeds> defaultTable = makeSpeedTable();
+	array<float, numSpeeds> calibratedTable;
+	const float* table = defaultTable.data();
+	float ratePerSpeed = -1.0f;
+};
+
+#endif
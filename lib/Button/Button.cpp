@@ -246,7 +246,7 @@ void Button::setHoldThreshold(unsigned int holdTime)
 */
 void Button::setButtonStatus(unsigned int _buttonstatus) 
 { 
-  _buttonstatus = _buttonstatus; 
+  buttonstatus = _buttonstatus; 
 }
 
 
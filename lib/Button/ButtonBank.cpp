@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include "soc/gpio_reg.h"
+#include "ButtonBank.h"
+
+/*
+|| @constructor
+|| | Spread the debounce time over the vertical counter samples
+|| #
+||
+|| @parameter debounceDuration time (ms) a pin must hold a new level before it counts
+|| @parameter holdDuration     press time (ms) before a hold event
+*/
+ButtonBank::ButtonBank(unsigned int debounceDuration, unsigned int holdDuration)
+  : holdDuration(holdDuration)
+{
+  sampleInterval = max(1u, (debounceDuration + debounceSamples - 1) / debounceSamples);
+  for (uint8_t i = 0; i < 64; i++) { pinToId[i] = -1; }
+}
+
+/*
+|| @description
+|| | Configure a pin as a button, sampling starts with begin()
+|| #
+||
+|| @return the button id used in events, -1 when all slots are taken
+*/
+int ButtonBank::addButton(uint8_t pin, uint8_t buttonMode)
+{
+  if (numButtons >= maxButtons || pin >= 64) { return -1; }
+  uint64_t bit = 1ULL << pin;
+  buttonMask |= bit;
+  if (buttonMode == BUTTON_PULLDOWN) {
+    pinMode(pin, INPUT_PULLDOWN);
+  }
+  else {
+    activeLowMask |= bit;
+    pinMode(pin, buttonMode == BUTTON_PULLUP_INTERNAL ? INPUT_PULLUP : INPUT);
+  }
+  pins[numButtons] = pin;
+  pinToId[pin] = numButtons;
+  return numButtons++;
+}
+
+/*
+|| @description
+|| | Take the current levels and start sampling.
+|| | A button already down (e.g. the one that woke the board) gives no click or hold for this press.
+|| #
+*/
+void ButtonBank::begin()
+{
+  state = readPressed();
+  count0 = count1 = 0;
+  trackedMask = heldMask = 0;
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = &ButtonBank::onSample;
+  timerArgs.arg = this;
+  timerArgs.name = "buttonBank";
+  esp_timer_create(&timerArgs, &sampleTimer);
+  esp_timer_start_periodic(sampleTimer, (uint64_t)sampleInterval * 1000ULL);
+}
+
+// One read of each input register, bit n = GPIO n pressed
+uint64_t ButtonBank::readPressed() const
+{
+  uint64_t levels = ((uint64_t)REG_READ(GPIO_IN1_REG) << 32) | REG_READ(GPIO_IN_REG);
+  return (levels ^ activeLowMask) & buttonMask;
+}
+
+void ButtonBank::onSample(void* arg)
+{
+  static_cast<ButtonBank*>(arg)->sample();
+}
+
+/*
+|| @description
+|| | Vertical counter debounce of all pins at once, then events for the pins that changed
+|| #
+*/
+void ButtonBank::sample()
+{
+  unsigned long now = millis();
+  uint64_t debounced = state.load(std::memory_order_relaxed);
+  // counters run while a pin differs from its debounced state and reset when it agrees
+  uint64_t delta = readPressed() ^ debounced;
+  count1 = (count1 ^ count0) & delta;
+  count0 = ~count0 & delta;
+  uint64_t toggle = delta & count0 & count1;
+  debounced ^= toggle;
+  state.store(debounced, std::memory_order_relaxed);
+
+  // the new level started debounceSamples - 1 samples ago
+  unsigned long edgeTime = now - (debounceSamples - 1) * sampleInterval;
+  while (toggle) {
+    uint8_t pin = __builtin_ctzll(toggle);
+    uint64_t bit = 1ULL << pin;
+    toggle &= toggle - 1;
+    uint8_t id = pinToId[pin];
+    if (debounced & bit) {
+      trackedMask |= bit;
+      heldMask &= ~bit;
+      pressTime[id] = edgeTime;
+      emit(id, BUTTON_EVENT_PRESS, edgeTime);
+    }
+    else {
+      emit(id, BUTTON_EVENT_RELEASE, edgeTime);
+      if ((trackedMask & ~heldMask) & bit) { emit(id, BUTTON_EVENT_CLICK, edgeTime); }
+      trackedMask &= ~bit;
+    }
+  }
+
+  // only pressed buttons still waiting for their hold are visited
+  uint64_t waiting = debounced & trackedMask & ~heldMask;
+  while (waiting) {
+    uint8_t pin = __builtin_ctzll(waiting);
+    uint64_t bit = 1ULL << pin;
+    waiting &= waiting - 1;
+    uint8_t id = pinToId[pin];
+    if (now - pressTime[id] >= holdDuration) {
+      heldMask |= bit;
+      emit(id, BUTTON_EVENT_HOLD, pressTime[id] + holdDuration);
+    }
+  }
+}
+
+void ButtonBank::emit(uint8_t id, ButtonEventType type, unsigned long time)
+{
+  uint8_t head = eventHead.load(std::memory_order_relaxed);
+  if ((uint8_t)(head - eventTail.load(std::memory_order_acquire)) >= eventQueueSize) { return; }
+  events[head % eventQueueSize] = {id, type, time};
+  eventHead.store(head + 1, std::memory_order_release);
+  if (wakeHandler) { wakeHandler(wakeArg); }
+}
+
+/*
+|| @description
+|| | Next pending event
+|| #
+||
+|| @return false when there is none
+*/
+bool ButtonBank::poll(ButtonEvent& event)
+{
+  uint8_t tail = eventTail.load(std::memory_order_relaxed);
+  if (tail == eventHead.load(std::memory_order_acquire)) { return false; }
+  event = events[tail % eventQueueSize];
+  eventTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool ButtonBank::isPressed(uint8_t id) const
+{
+  return (state.load(std::memory_order_relaxed) >> pins[id]) & 1;
+}
+
+bool ButtonBank::isSettling() const
+{
+  return false;
+}
+
+/*
+|| @description
+|| | Lets a caller block between events instead of polling.
+|| | The sample timer keeps running, so the chip still wakes every sample interval
+|| #
+*/
+void ButtonBank::setWakeHandler(ButtonWakeHandler handler, void* arg)
+{
+  wakeHandler = handler;
+  wakeArg = arg;
+}
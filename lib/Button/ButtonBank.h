@@ -0,0 +1,65 @@
+#ifndef ButtonBank_h
+#define ButtonBank_h
+
+#include <inttypes.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "ButtonEngine.h"
+
+/*
+|| Sampled bank of buttons.
+|| A periodic esp_timer reads both GPIO input registers at once and debounces every pin with
+|| two bit vertical counters: a pin changes state only after it has differed for
+|| debounceSamples consecutive samples, whatever the number of buttons.
+|| Produces the same events as ButtonEngine.
+*/
+class ButtonBank {
+  public:
+    static const uint8_t maxButtons = 8;
+
+    ButtonBank(unsigned int debounceDuration=20, unsigned int holdDuration=1000);
+
+    int addButton(uint8_t pin, uint8_t buttonMode=BUTTON_PULLDOWN);  // -1 when full
+    void begin();
+    bool poll(ButtonEvent& event);        // false when no event is pending
+    bool isPressed(uint8_t id) const;
+    bool isSettling() const;              // always false, the sample timer settles levels itself
+    void setWakeHandler(ButtonWakeHandler handler, void* arg);
+
+  private:
+    ButtonWakeHandler    wakeHandler = nullptr;
+    void*                wakeArg = nullptr;
+
+    static const uint8_t debounceSamples = 3;   // two bit counters count to three
+    unsigned int         sampleInterval;        // ms
+    unsigned int         holdDuration;
+
+    // bit n is GPIO n
+    uint64_t             buttonMask = 0;
+    uint64_t             activeLowMask = 0;     // pull-up buttons read low when pressed
+    std::atomic<uint64_t> state{0};             // debounced, 1 = pressed
+    uint64_t             count0 = 0;            // vertical counter bits
+    uint64_t             count1 = 0;
+    uint64_t             trackedMask = 0;       // press seen, so release can be a click
+    uint64_t             heldMask = 0;          // hold event issued for this press
+
+    uint8_t              pins[maxButtons];
+    int8_t               pinToId[64];
+    unsigned long        pressTime[maxButtons];
+    uint8_t              numButtons = 0;
+
+    // written by the sample timer, read by poll()
+    static const uint8_t eventQueueSize = 32;   // power of two
+    ButtonEvent          events[eventQueueSize];
+    std::atomic<uint8_t> eventHead{0};
+    std::atomic<uint8_t> eventTail{0};
+
+    esp_timer_handle_t   sampleTimer = nullptr;
+
+    static void onSample(void* arg);
+    uint64_t readPressed() const;
+    void sample();
+    void emit(uint8_t id, ButtonEventType type, unsigned long time);
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include <Arduino.h>
+#include "ButtonEngine.h"
+
+/*
+|| @constructor
+|| | Set the debounce and hold durations shared by all buttons
+|| #
+||
+|| @parameter debounceDuration edges closer than this (ms) to the last accepted one are bounces
+|| @parameter holdDuration     press time (ms) before a hold event
+*/
+ButtonEngine::ButtonEngine(unsigned int debounceDuration, unsigned int holdDuration)
+  : debounceDuration(debounceDuration), holdDuration(holdDuration) {}
+
+/*
+|| @description
+|| | Configure a pin as a button, interrupts are attached by begin()
+|| #
+||
+|| @return the button id used in events, -1 when all slots are taken
+*/
+int ButtonEngine::addButton(uint8_t pin, uint8_t buttonMode)
+{
+  if (numButtons >= maxButtons) { return -1; }
+  Channel& channel = channels[numButtons];
+  channel.engine = this;
+  channel.id = numButtons;
+  channel.pin = pin;
+  if (buttonMode == BUTTON_PULLDOWN) {
+    channel.mode = LOW;
+    pinMode(pin, INPUT_PULLDOWN);
+  }
+  else {
+    channel.mode = HIGH;
+    pinMode(pin, buttonMode == BUTTON_PULLUP_INTERNAL ? INPUT_PULLUP : INPUT);
+  }
+  return numButtons++;
+}
+
+/*
+|| @description
+|| | Take the current levels and start listening for edges.
+|| | A button already down (e.g. the one that woke the board) gives no click or hold for this press.
+|| #
+*/
+void ButtonEngine::begin()
+{
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < numButtons; i++) {
+    Channel& channel = channels[i];
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &ButtonEngine::onHoldTimer;
+    timerArgs.arg = &channel;
+    timerArgs.name = "buttonHold";
+    esp_timer_create(&timerArgs, &channel.holdTimer);
+
+    channel.pressed = readPressed(channel);
+    channel.rawPressed = channel.pressed;
+    channel.tracked = false;
+    channel.changeTime = now;
+    attachInterruptArg(channel.pin, &ButtonEngine::onEdge, &channel, CHANGE);
+  }
+}
+
+bool IRAM_ATTR ButtonEngine::readPressed(const Channel& channel) const
+{
+  return digitalRead(channel.pin) != channel.mode;
+}
+
+/*
+|| @description
+|| | GPIO interrupt: record the level and the time, nothing else
+|| #
+*/
+void IRAM_ATTR ButtonEngine::onEdge(void* arg)
+{
+  Channel* channel = static_cast<Channel*>(arg);
+  ButtonEngine* engine = channel->engine;
+  bool pressed = engine->readPressed(*channel);
+  uint8_t head = engine->edgeHead.load(std::memory_order_relaxed);
+  uint8_t tail = engine->edgeTail.load(std::memory_order_acquire);
+  // a full queue drops the edge, rawPressed still has the final level
+  if ((uint8_t)(head - tail) < edgeQueueSize) {
+    Edge& edge = engine->edges[head % edgeQueueSize];
+    edge.button = channel->id;
+    edge.pressed = pressed;
+    edge.time = millis();
+    engine->edgeHead.store(head + 1, std::memory_order_release);
+  }
+  channel->rawPressed = pressed;
+  if (engine->wakeHandler) { engine->wakeHandler(engine->wakeArg); }
+}
+
+void ButtonEngine::onHoldTimer(void* arg)
+{
+  Channel* channel = static_cast<Channel*>(arg);
+  channel->holdDue = true;
+  ButtonEngine* engine = channel->engine;
+  if (engine->wakeHandler) { engine->wakeHandler(engine->wakeArg); }
+}
+
+/*
+|| @description
+|| | Debounced state change; issues press, release, click and hold events
+|| #
+*/
+void ButtonEngine::accept(Channel& channel, bool pressed, unsigned long time)
+{
+  unsigned long pressTime = channel.changeTime;
+  channel.pressed = pressed;
+  channel.changeTime = time;
+  esp_timer_stop(channel.holdTimer);
+  channel.holdDue = false;
+
+  if (pressed) {
+    channel.tracked = true;
+    channel.holdFired = false;
+    emit(channel.id, BUTTON_EVENT_PRESS, time);
+    unsigned long elapsed = millis() - time;
+    if (elapsed >= holdDuration) { channel.holdDue = true; }
+    else { esp_timer_start_once(channel.holdTimer, (uint64_t)(holdDuration - elapsed) * 1000ULL); }
+    return;
+  }
+
+  // a late drained release still knows from the timestamps whether this was a hold
+  bool held = time - pressTime >= holdDuration;
+  if (channel.tracked && !channel.holdFired && held) {
+    emit(channel.id, BUTTON_EVENT_HOLD, pressTime + holdDuration);
+    channel.holdFired = true;
+  }
+  emit(channel.id, BUTTON_EVENT_RELEASE, time);
+  if (channel.tracked && !channel.holdFired) {
+    emit(channel.id, BUTTON_EVENT_CLICK, time);
+  }
+  channel.tracked = false;
+}
+
+void ButtonEngine::emit(uint8_t id, ButtonEventType type, unsigned long time)
+{
+  uint8_t next = (eventHead + 1) % eventQueueSize;
+  if (next == eventTail) { return; }
+  events[eventHead] = {id, type, time};
+  eventHead = next;
+}
+
+/*
+|| @description
+|| | Drain the raw edges and turn them into events
+|| #
+*/
+void ButtonEngine::process()
+{
+  uint8_t tail = edgeTail.load(std::memory_order_relaxed);
+  uint8_t head = edgeHead.load(std::memory_order_acquire);
+  while (tail != head) {
+    const Edge& edge = edges[tail % edgeQueueSize];
+    Channel& channel = channels[edge.button];
+    // lockout debounce: the first edge after a quiet period counts, its bounces do not
+    if (edge.pressed != channel.pressed && edge.time - channel.changeTime >= debounceDuration) {
+      accept(channel, edge.pressed, edge.time);
+    }
+    tail++;
+  }
+  edgeTail.store(tail, std::memory_order_release);
+
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < numButtons; i++) {
+    Channel& channel = channels[i];
+    // a bounce ignored during the lockout may have been the final level
+    bool rawPressed = channel.rawPressed;
+    if (rawPressed != channel.pressed && now - channel.changeTime >= debounceDuration) {
+      accept(channel, rawPressed, channel.changeTime + debounceDuration);
+    }
+    if (channel.holdDue.exchange(false) && channel.pressed && channel.tracked && !channel.holdFired) {
+      channel.holdFired = true;
+      emit(channel.id, BUTTON_EVENT_HOLD, channel.changeTime + holdDuration);
+    }
+  }
+}
+
+/*
+|| @description
+|| | Next pending event
+|| #
+||
+|| @return false when there is none
+*/
+bool ButtonEngine::poll(ButtonEvent& event)
+{
+  process();
+  if (eventTail == eventHead) { return false; }
+  event = events[eventTail];
+  eventTail = (eventTail + 1) % eventQueueSize;
+  return true;
+}
+
+bool ButtonEngine::isPressed(uint8_t id) const
+{
+  return channels[id].pressed;
+}
+
+/*
+|| @description
+|| | True while a raw level differs from the debounced one. Only poll() settles it,
+|| | no further edge may come to wake a caller that blocks
+|| #
+*/
+bool ButtonEngine::isSettling() const
+{
+  for (uint8_t i = 0; i < numButtons; i++) {
+    if (channels[i].rawPressed != channels[i].pressed) { return true; }
+  }
+  return false;
+}
+
+/*
+|| @description
+|| | Lets a caller block between events instead of polling
+|| #
+*/
+void ButtonEngine::setWakeHandler(ButtonWakeHandler handler, void* arg)
+{
+  wakeHandler = handler;
+  wakeArg = arg;
+}
@@ -0,0 +1,90 @@
+#ifndef ButtonEngine_h
+#define ButtonEngine_h
+
+#include <inttypes.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "Button.h"
+
+enum ButtonEventType {
+  BUTTON_EVENT_PRESS   = 0,
+  BUTTON_EVENT_RELEASE = 1,
+  BUTTON_EVENT_CLICK   = 2,  // release before the hold time
+  BUTTON_EVENT_HOLD    = 3,  // once per press, after the hold time
+};
+
+struct ButtonEvent {
+  uint8_t         button;    // id returned by addButton()
+  ButtonEventType type;
+  unsigned long   time;      // millis() of the debounced edge
+};
+
+// Called whenever poll() may have something new; from the GPIO ISR or the timer task
+typedef void (*ButtonWakeHandler)(void* arg);
+
+/*
+|| Interrupt driven buttons.
+|| GPIO edge interrupts push timestamped raw edges into a lock-free queue, debouncing and
+|| hold detection run on those timestamps when the queue is drained, and an esp_timer per
+|| button marks holds that are due. Events carry the time of the edge, not of the poll.
+*/
+class ButtonEngine {
+  public:
+    static const uint8_t maxButtons = 4;
+
+    ButtonEngine(unsigned int debounceDuration=20, unsigned int holdDuration=1000);
+
+    int addButton(uint8_t pin, uint8_t buttonMode=BUTTON_PULLDOWN);  // -1 when full
+    void begin();
+    bool poll(ButtonEvent& event);        // false when no event is pending
+    bool isPressed(uint8_t id) const;
+    bool isSettling() const;              // a level is waiting out the debounce lockout
+    void setWakeHandler(ButtonWakeHandler handler, void* arg);
+
+  private:
+    ButtonWakeHandler    wakeHandler = nullptr;
+    void*                wakeArg = nullptr;
+
+    struct Edge {
+      uint8_t       button;
+      bool          pressed;
+      unsigned long time;
+    };
+    static const uint8_t edgeQueueSize = 32;    // power of two
+    Edge                 edges[edgeQueueSize];
+    std::atomic<uint8_t> edgeHead{0};           // written by the ISR only
+    std::atomic<uint8_t> edgeTail{0};           // written by poll() only
+
+    static const uint8_t eventQueueSize = 16;
+    ButtonEvent          events[eventQueueSize];
+    uint8_t              eventHead = 0;
+    uint8_t              eventTail = 0;
+
+    struct Channel {
+      ButtonEngine*      engine;
+      uint8_t            id;
+      uint8_t            pin;
+      uint8_t            mode;
+      std::atomic<bool>  rawPressed{false};     // level at the last edge
+      bool               pressed = false;       // debounced
+      bool               tracked = false;       // press seen, so release can be a click
+      bool               holdFired = false;
+      std::atomic<bool>  holdDue{false};
+      unsigned long      changeTime = 0;
+      esp_timer_handle_t holdTimer = nullptr;
+    };
+    Channel              channels[maxButtons];
+    uint8_t              numButtons = 0;
+
+    unsigned int         debounceDuration;
+    unsigned int         holdDuration;
+
+    static void onEdge(void* arg);
+    static void onHoldTimer(void* arg);
+    bool readPressed(const Channel& channel) const;
+    void accept(Channel& channel, bool pressed, unsigned long time);
+    void emit(uint8_t id, ButtonEventType type, unsigned long time);
+    void process();
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include "GestureRecognizer.h"
+
+/*
+|| @constructor
+|| | Run a compiled gesture table
+|| #
+||
+|| @parameter rows        transitions from compileGestures()
+|| @parameter sequenceGap longest pause (ms) between the tokens of one gesture
+*/
+GestureRecognizer::GestureRecognizer(const GestureTransition* rows, uint8_t size, unsigned int sequenceGap)
+  : rows(rows), size(size), sequenceGap(sequenceGap) {}
+
+/*
+|| @description
+|| | Limit recognition to the gestures that mean something right now.
+|| | Disabled gestures neither dispatch nor keep a shorter one waiting.
+|| #
+*/
+void GestureRecognizer::setEnabled(uint32_t mask)
+{
+  enabledMask = mask;
+}
+
+/*
+|| @description
+|| | Turn button events into tokens
+|| #
+*/
+void GestureRecognizer::handle(const ButtonEvent& event)
+{
+  uint8_t bit = 1 << event.button;
+  switch (event.type) {
+    case BUTTON_EVENT_PRESS:
+      pressedMask |= bit;
+      consumedMask &= ~bit;
+      break;
+
+    case BUTTON_EVENT_RELEASE:
+      pressedMask &= ~bit;
+      heldMask &= ~bit;
+      break;
+
+    case BUTTON_EVENT_CLICK: {
+      uint8_t others = pressedMask & ~bit;
+      if (others) {
+        // the held button belongs to the chord, it gives no click or hold of its own
+        consumedMask |= others;
+        heldMask &= ~others;
+        feed(gestureChord(__builtin_ctz(others), event.button), event.time);
+      }
+      else if (!(consumedMask & bit)) {
+        feed(gestureClick(event.button), event.time);
+      }
+      break;
+    }
+
+    case BUTTON_EVENT_HOLD:
+      if (consumedMask & bit) { break; }
+      heldMask |= bit;
+      lastHoldTime = event.time;
+      feed(gestureHold(event.button), event.time);
+      break;
+
+    default:
+      break;
+  }
+}
+
+int8_t GestureRecognizer::nextState(uint8_t token) const
+{
+  for (uint8_t r = 1; r < size; r++) {
+    if (rows[r].from == state && rows[r].token == token) { return r; }
+  }
+  return -1;
+}
+
+void GestureRecognizer::feed(uint8_t token, unsigned long time)
+{
+  int8_t next = nextState(token);
+  if (next < 0 && state != 0) {
+    // the pending sequence cannot continue with this token: settle it and start over
+    finish();
+    next = nextState(token);
+  }
+  if (next < 0) { return; }
+  state = next;
+  lastTokenTime = time;
+  // nothing longer can match, no reason to wait
+  if (!(rows[state].longerMask & enabledMask)) { finish(); }
+}
+
+bool GestureRecognizer::isEnabled(int8_t gesture) const
+{
+  return gesture != GESTURE_NONE && (enabledMask & (1UL << gesture));
+}
+
+void GestureRecognizer::dispatch(int8_t gesture)
+{
+  if (!isEnabled(gesture)) { return; }
+  uint8_t next = (readyHead + 1) % readySize;
+  if (next == readyTail) { return; }
+  ready[readyHead] = gesture;
+  readyHead = next;
+}
+
+void GestureRecognizer::finish()
+{
+  dispatch(rows[state].gesture);
+  state = 0;
+}
+
+/*
+|| @description
+|| | Next recognised gesture; settles a waiting prefix once the gap has passed
+|| #
+*/
+bool GestureRecognizer::poll(uint8_t& gesture, unsigned long now)
+{
+  if (state != 0 && now - lastTokenTime > sequenceGap) { finish(); }
+  if (readyTail == readyHead) { return false; }
+  gesture = ready[readyTail];
+  readyTail = (readyTail + 1) % readySize;
+  return true;
+}
+
+bool GestureRecognizer::isHeld(uint8_t button) const
+{
+  return heldMask & (1 << button);
+}
+
+bool GestureRecognizer::isBusy() const
+{
+  return pressedMask || state != 0;
+}
+
+/*
+|| @description
+|| | True while a button held past the hold time can still become the held side of an
+|| | enabled chord, for one sequence gap after the hold
+|| #
+*/
+bool GestureRecognizer::isChordPending(uint8_t heldButton, unsigned long now) const
+{
+  if (!isHeld(heldButton) || now - lastHoldTime > sequenceGap) { return false; }
+  for (uint8_t r = 1; r < size; r++) {
+    uint8_t token = rows[r].token;
+    if (rows[r].from != state || (token >> 6) != TOKEN_CHORD || ((token >> 3) & 7) != heldButton) { continue; }
+    if (isEnabled(rows[r].gesture) || (rows[r].longerMask & enabledMask)) { return true; }
+  }
+  return false;
+}
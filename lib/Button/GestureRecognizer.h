@@ -0,0 +1,116 @@
+#ifndef GestureRecognizer_h
+#define GestureRecognizer_h
+
+#include <inttypes.h>
+#include <array>
+#include "ButtonEngine.h"
+
+/*
+|| Gestures are sequences of tokens, each a click, a long hold, or a chord (a click of one
+|| button while another is held), separated by no more than the sequence gap.
+|| The gesture definitions are compiled into a prefix tree at compile time; at runtime a
+|| gesture is dispatched as soon as no longer enabled gesture can still match, and only
+|| ambiguous prefixes (a click that may become a double click) wait for the gap.
+*/
+
+static const uint8_t maxGestureLength = 4;
+static const int8_t  GESTURE_NONE = -1;
+
+enum GestureTokenKind {
+  TOKEN_CLICK = 0,
+  TOKEN_HOLD  = 1,
+  TOKEN_CHORD = 2,
+};
+
+// kind in bits 6-7, held button in bits 3-5, clicked or held button in bits 0-2
+constexpr uint8_t gestureToken(GestureTokenKind kind, uint8_t button, uint8_t heldButton=0) {
+  return (uint8_t)((kind << 6) | ((heldButton & 7) << 3) | (button & 7));
+}
+constexpr uint8_t gestureClick(uint8_t button) { return gestureToken(TOKEN_CLICK, button); }
+constexpr uint8_t gestureHold(uint8_t button) { return gestureToken(TOKEN_HOLD, button); }
+constexpr uint8_t gestureChord(uint8_t heldButton, uint8_t clickedButton) {
+  return gestureToken(TOKEN_CHORD, clickedButton, heldButton);
+}
+
+struct GestureDef {
+  uint8_t gesture;                      // < 32, used as a bit in the enabled mask
+  uint8_t length;
+  uint8_t tokens[maxGestureLength];
+};
+
+// Row i is the state reached by taking `token` from state `from`; row 0 is the start state
+struct GestureTransition {
+  uint8_t  from;
+  uint8_t  token;
+  int8_t   gesture;                     // completed here, GESTURE_NONE if only a prefix
+  uint32_t longerMask;                  // gestures that continue past this state
+};
+
+template <size_t N>
+struct GestureTable {
+  std::array<GestureTransition, N * maxGestureLength + 1> rows;
+  uint8_t size;
+};
+
+template <size_t N>
+constexpr GestureTable<N> compileGestures(const GestureDef (&defs)[N]) {
+  GestureTable<N> table = {};
+  table.rows[0] = {0, 0, GESTURE_NONE, 0};
+  table.size = 1;
+  for (size_t d = 0; d < N; ++d) {
+    uint8_t state = 0;
+    for (uint8_t t = 0; t < defs[d].length; ++t) {
+      table.rows[state].longerMask |= 1UL << defs[d].gesture;
+      uint8_t next = 0;
+      for (uint8_t r = 1; r < table.size; ++r) {
+        if (table.rows[r].from == state && table.rows[r].token == defs[d].tokens[t]) { next = r; }
+      }
+      if (next == 0) {
+        next = table.size++;
+        table.rows[next] = {state, defs[d].tokens[t], GESTURE_NONE, 0};
+      }
+      state = next;
+    }
+    table.rows[state].gesture = defs[d].gesture;
+  }
+  return table;
+}
+
+class GestureRecognizer {
+  public:
+    GestureRecognizer(const GestureTransition* rows, uint8_t size, unsigned int sequenceGap=400);
+
+    void setEnabled(uint32_t mask);
+    void handle(const ButtonEvent& event);
+    bool poll(uint8_t& gesture, unsigned long now);  // false when nothing is ready
+    bool isHeld(uint8_t button) const;      // held past the hold time and not part of a chord
+    bool isBusy() const;                    // a button is down or a sequence is pending
+    bool isChordPending(uint8_t heldButton, unsigned long now) const;  // an enabled chord may still follow the hold
+
+  private:
+    const GestureTransition* rows;
+    uint8_t                  size;
+    unsigned int             sequenceGap;
+    uint32_t                 enabledMask = 0xFFFFFFFF;
+
+    uint8_t                  state = 0;
+    unsigned long            lastTokenTime = 0;
+    unsigned long            lastHoldTime = 0;
+
+    uint8_t                  pressedMask = 0;
+    uint8_t                  heldMask = 0;
+    uint8_t                  consumedMask = 0;  // held side of a chord, its release is not a click
+
+    static const uint8_t     readySize = 8;
+    uint8_t                  ready[readySize];
+    uint8_t                  readyHead = 0;
+    uint8_t                  readyTail = 0;
+
+    void feed(uint8_t token, unsigned long time);
+    int8_t nextState(uint8_t token) const;
+    bool isEnabled(int8_t gesture) const;
+    void dispatch(int8_t gesture);
+    void finish();
+};
+
+#endif
@@ -9,13 +9,25 @@ Battery::Battery(gpio_num_t battery_gpio, adc1_channel_t channel, adc_unit_t adc
             : battery_gpio(battery_gpio), adcChannel(channel), adcUnit(adcUnit) {}
 
 void Battery::setup() {
-    rtc_gpio_hold_dis(battery_gpio);  
     adc1_config_width(ADC_WIDTH_BIT_12);
     adc1_config_channel_atten(adcChannel, ADC_ATTEN_DB_12);  // up to 3.1V
     esp_adc_cal_characterize(adcUnit, ADC_ATTEN_DB_12, ADC_WIDTH_BIT_12, DEFAULT_VREF, &adcChars);
 
-    // calibrate actual full or empty battery voltage limits
-    calibrateVoltageLimits();
+    // calibrate actual full or empty battery voltage limits, then measure the level
+    measurement.begin(true);
+    supplyVoltage = readRawVoltage();
+    lastSupplySampleTime = millis();
+}
+
+void Battery::update() {
+    unsigned long now = millis();
+    if (now - lastSupplySampleTime < supplySampleInterval) { return; }
+    lastSupplySampleTime = now;
+    supplyVoltage = supplyAlpha * readRawVoltage() + (1.0f - supplyAlpha) * supplyVoltage;
+}
+
+float Battery::getSupplyVoltage() const {
+    return supplyVoltage;
 }
 
 float Battery::readRawVoltage() const {
@@ -24,15 +36,56 @@ float Battery::readRawVoltage() const {
     return (millivolts / 1000.0f) * voltageDividerRatio;
 }
 
-float Battery::getStableVoltage() const {
-    float sum = 0.0f;
-    for (int i = 0; i < numReading; ++i) {
-        sum += constrain(readRawVoltage(), rtcEmptyVoltage, rtcFullVoltage);
-        delay(10);
+void Battery::startMeasurement() {
+    if (!measurement.isRunning()) { measurement.begin(false); }
+}
+
+bool Battery::updateMeasurement() {
+    if (!measurement.isRunning()) { return false; }
+    return !measurement.update();
+}
+
+bool Battery::isMeasuring() const {
+    return measurement.isRunning();
+}
+
+unsigned long Battery::timeToNextStep() const {
+    return measurement.timeToNextStep();
+}
+
+void Battery::Measurement::begin(bool calibrate) {
+    calibrating = calibrate;
+    calibrations = 0;
+    readings = 0;
+    sum = 0.0f;
+    start();
+}
+
+void Battery::Measurement::step() {
+    switch (phase) {
+        case SAMPLE: {
+            float voltage = battery.readRawVoltage(); // constrain() would read it more than once
+            sum += constrain(voltage, rtcEmptyVoltage, rtcFullVoltage);
+            if (++readings < battery.numReading) { waitFor(battery.numReadingInterval, SAMPLE); }
+            else { next(AVERAGE); }
+            break;
+        }
+
+        case AVERAGE: {
+            float voltage = roundf(sum / readings * 100.0f) / 100.0f; // rounded to 2 decimal digits
+            readings = 0;
+            sum = 0.0f;
+            if (calibrating) {
+                calibrating = battery.calibrateVoltageLimits(voltage) && ++calibrations < battery.numCalibrations;
+                // the level is measured afresh against the new limits
+                waitFor(battery.numReadingInterval, SAMPLE);
+                break;
+            }
+            battery.level = battery.levelFor(voltage);
+            finish();
+            break;
+        }
     }
-    float voltage = sum / numReading;
-    float rounded = roundf(voltage * 100.0f) / 100.0f; // return voltage rounded to 2 decimal digits
-    return rounded;
 }
 
 float Battery::voltageToPercentage(float voltage) const {
@@ -40,17 +93,8 @@ float Battery::voltageToPercentage(float voltage) const {
     return constrain(percent, 0.0f, 100.0f);
 }
 
-int Battery::getBatteryPercentage() const {
-    float voltage = getStableVoltage();
-    // Serial.print("RTC Full Voltage: ");
-    // Serial.println(rtcFullVoltage);
-    // Serial.print("Battery Voltage: ");
-    // Serial.println(voltage, 2);
-    return (int)floorf(voltageToPercentage(voltage));
-}
-
-int Battery::getBatteryLevel() const {
-    int percent = getBatteryPercentage();
+int Battery::levelFor(float voltage) const {
+    int percent = (int)floorf(voltageToPercentage(voltage));
     Serial.print("Battery Percent: ");
     Serial.println(percent);
     if (percent < batteryCriticalThreshold) { return BATTERY_CRITICAL; }
@@ -59,6 +103,10 @@ int Battery::getBatteryLevel() const {
     else { return BATTERY_HIGH; }
 }
 
+int Battery::getBatteryLevel() const {
+    return level;
+}
+
 void Battery::maybeUpdateFullVoltage(float voltage) {
     if (voltage >= fullVoltage - voltageCalibOffset) {
         rtcFullVoltage = (1.0f - learningRate) * rtcFullVoltage + learningRate * voltage;
@@ -73,20 +121,19 @@ void Battery::maybeUpdateEmptyVoltage(float voltage) {
     }
 }
 
-void Battery::calibrateVoltageLimits() {
-    for (int i = 0; i < numCalibrations; ++i) {
-        float voltage = getStableVoltage();
-        int percent = (int)floorf(voltageToPercentage(voltage));
-        // Serial.print("RTC Full Voltage: ");
-        // Serial.println(rtcFullVoltage);
-        // Serial.print("Battery Voltage: ");
-        // Serial.println(voltage, 2);
-        if (percent > batteryModerateThreshold && fabsf(voltage - rtcFullVoltage) > voltageCalibEpsilon) {
-            maybeUpdateFullVoltage(voltage);
-        } 
-        else if (percent < batteryWarningThreshold && fabsf(voltage - rtcEmptyVoltage) > voltageCalibEpsilon) {
-            maybeUpdateEmptyVoltage(voltage);
-        } 
-        else { return; } // Exit early if voltage is within expected range
-    }
+bool Battery::calibrateVoltageLimits(float voltage) {
+    int percent = (int)floorf(voltageToPercentage(voltage));
+    // Serial.print("RTC Full Voltage: ");
+    // Serial.println(rtcFullVoltage);
+    // Serial.print("Battery Voltage: ");
+    // Serial.println(voltage, 2);
+    if (percent > batteryModerateThreshold && fabsf(voltage - rtcFullVoltage) > voltageCalibEpsilon) {
+        maybeUpdateFullVoltage(voltage);
+        return true;
+    } 
+    else if (percent < batteryWarningThreshold && fabsf(voltage - rtcEmptyVoltage) > voltageCalibEpsilon) {
+        maybeUpdateEmptyVoltage(voltage);
+        return true;
+    } 
+    return false; // stop early if voltage is within expected range
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "BeanProfiles.h"
+
+const char* const BeanProfiles::names[BeanProfiles::numProfiles] = { "default", "light", "medium", "dark" };
+const FeedMode BeanProfiles::defaultFeedModes[BeanProfiles::numProfiles] = { FEED_CONTINUOUS, FEED_PULSED, FEED_CONTINUOUS, FEED_PULSED };
+
+void BeanProfiles::setup() {
+	prefs.begin(nvsNamespace, false);
+	active = constrain((int)prefs.getUChar("active", 0), 0, numProfiles - 1);
+	load();
+}
+
+void BeanProfiles::load() {
+	char key[8];
+	snprintf(key, sizeof(key), "curve%d", active);
+	bool learned = flowModel.load(prefs, key);
+	snprintf(key, sizeof(key), "rate%d", active);
+	targetRate = prefs.getFloat(key, defaultTargetRate);
+	targetModified = false;
+	snprintf(key, sizeof(key), "mode%d", active);
+	feedMode = (FeedMode)prefs.getUChar(key, defaultFeedModes[active]);
+
+	Serial.print("Bean profile: ");
+	Serial.print(getName());
+	Serial.print(getFeedMode() == FEED_PULSED ? ", pulsed" : ", continuous");
+	Serial.println(learned ? " (learned flow curve)" : " (no flow curve yet)");
+}
+
+void BeanProfiles::save() {
+	char key[8];
+	if (flowModel.isModified()) {
+		snprintf(key, sizeof(key), "curve%d", active);
+		flowModel.save(prefs, key);
+	}
+	if (targetModified) {
+		snprintf(key, sizeof(key), "rate%d", active);
+		prefs.putFloat(key, targetRate);
+		targetModified = false;
+	}
+}
+
+void BeanProfiles::next() {
+	save();
+	active = (active + 1) % numProfiles;
+	prefs.putUChar("active", active);
+	load();
+}
+
+int BeanProfiles::getIndex() const {
+	return active;
+}
+
+const char* BeanProfiles::getName() const {
+	return names[active];
+}
+
+FeedMode BeanProfiles::getFeedMode() const {
+	return feedMode;
+}
+
+void BeanProfiles::toggleFeedMode() {
+	feedMode = feedMode == FEED_PULSED ? FEED_CONTINUOUS : FEED_PULSED;
+	char key[8];
+	snprintf(key, sizeof(key), "mode%d", active);
+	prefs.putUChar(key, feedMode);
+	Serial.print("Feed mode: ");
+	Serial.println(feedMode == FEED_PULSED ? "pulsed" : "continuous");
+}
+
+FlowModel& BeanProfiles::getFlowModel() {
+	return flowModel;
+}
+
+float BeanProfiles::getTargetRate() const {
+	return targetRate;
+}
+
+void BeanProfiles::setTargetRate(float rate) {
+	if (fabsf(rate - targetRate) < targetRateEpsilon) { return; }
+	targetRate = rate;
+	targetModified = true;
+}
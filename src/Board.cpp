@@ -1,109 +1,416 @@
 #include "Board.h"
 #include <Arduino.h>
 
+// Compiled into a prefix tree at build time. A gesture fires as soon as no longer
+// enabled one shares its prefix, see enabledGestures()
+static constexpr GestureDef gestureDefs[] = {
+    { GESTURE_UP_CLICK,           1, { gestureClick(BUTTON_UP) } },
+    { GESTURE_UP_DOUBLE_CLICK,    2, { gestureClick(BUTTON_UP), gestureClick(BUTTON_UP) } },
+    { GESTURE_UP_TRIPLE_CLICK,    3, { gestureClick(BUTTON_UP), gestureClick(BUTTON_UP), gestureClick(BUTTON_UP) } },
+    { GESTURE_DOWN_CLICK,         1, { gestureClick(BUTTON_DOWN) } },
+    { GESTURE_DOWN_DOUBLE_CLICK,  2, { gestureClick(BUTTON_DOWN), gestureClick(BUTTON_DOWN) } },
+    { GESTURE_DOWN_HOLD,          1, { gestureHold(BUTTON_DOWN) } },
+    { GESTURE_UP_HOLD_DOWN_CLICK, 1, { gestureChord(BUTTON_UP, BUTTON_DOWN) } },
+};
+static constexpr auto gestureTable = compileGestures(gestureDefs);
+
+// Chimes: frequency (Hz, 0 rest), duration (ms), gap after (ms)
+static constexpr ChimeNote batteryLevelChime[]           = { {800, 300, 150} };  // once per level
+static constexpr ChimeNote batteryCriticalChime[]        = { {1000, 150, 0}, {800, 150, 0}, {600, 200, 0} };
+static constexpr ChimeNote startupChime[]                = { {1000, 150, 0}, {1300, 150, 0}, {1600, 150, 0}, {2000, 200, 0} };
+static constexpr ChimeNote deepSleepChime[]              = { {1800, 150, 0}, {1400, 150, 0}, {1000, 150, 0}, {600, 300, 0} };
+static constexpr ChimeNote profileChime[]                = { {1200, 100, 100} }; // once per profile index
+static constexpr ChimeNote pulsedFeedChime[]             = { {1400, 80, 80}, {1400, 80, 0} };
+static constexpr ChimeNote continuousFeedChime[]         = { {1400, 300, 0} };
+static constexpr ChimeNote characterizationDoneChime[]   = { {1600, 150, 0}, {2000, 200, 0} };
+static constexpr ChimeNote characterizationFailedChime[] = { {600, 400, 0} };
+
+// States: parent, CPU profile while waiting, tick (ms), wake sources besides the buttons
+// and load cell sampling. A tick of 0 leaves the loop to events and sequence deadlines
+static constexpr BoardStateConfig boardStates[STATE_COUNT] = {
+    { STATE_AWAKE,          "awake",          STATE_AWAKE, POWER_IDLE,           0,  0,                 false },
+    { STATE_READY,          "ready",          STATE_AWAKE, POWER_IDLE,           0,  0,                 false },
+    { STATE_IDLE,           "idle",           STATE_READY, POWER_IDLE,           0,  0,                 false },
+    { STATE_CHIMING,        "chiming",        STATE_READY, POWER_CHIME,          10, 0,                 false },
+    { STATE_STOPPING,       "stopping",       STATE_READY, POWER_WAITING,        10, 0,                 true  }, // brake, then the post-stop reading
+    { STATE_SHOT,           "shot",           STATE_AWAKE, POWER_FEEDING,        10, 0,                 true  },
+    { STATE_STARTING,       "starting",       STATE_SHOT,  POWER_FEEDING,        10, 0,                 true  }, // the loop reads nothing before tared,
+    { STATE_TARING,         "taring",         STATE_SHOT,  POWER_FEEDING,        10, 0,                 true  }, // the safety cutoff does
+    { STATE_FEEDING,        "feeding",        STATE_SHOT,  POWER_FEEDING,        10, LOOP_EVENT_SAMPLE, true  },
+    { STATE_CHARACTERIZING, "characterizing", STATE_AWAKE, POWER_CHARACTERIZING, 10, LOOP_EVENT_SAMPLE, true  },
+    { STATE_SLEEPING,       "sleeping",       STATE_AWAKE, POWER_IDLE,           0,  0,                 false }, // the sequence sets its deadlines
+    { STATE_FAULT,          "fault",          STATE_AWAKE, POWER_IDLE,           0,  0,                 false },
+};
+static_assert(statesInOrder(boardStates, STATE_COUNT), "boardStates must follow BoardState, parents first");
+
+// First match wins, a row on a parent covers all its children
+static constexpr BoardTransition boardTransitions[] = {
+    { STATE_READY,          EVENT_PRESS_START,      STATE_STARTING },
+    { STATE_READY,          EVENT_START,            STATE_TARING },
+    { STATE_READY,          EVENT_CHARACTERIZE,     STATE_CHARACTERIZING },
+    { STATE_READY,          EVENT_BATTERY_CRITICAL, STATE_FAULT },
+    { STATE_IDLE,           EVENT_CHIME,            STATE_CHIMING },
+    { STATE_CHIMING,        EVENT_CHIME_DONE,       STATE_IDLE },
+    { STATE_STOPPING,       EVENT_STOPPED,          STATE_IDLE },
+    { STATE_STARTING,       EVENT_START,            STATE_TARING },   // confirmed, the tare time runs on
+    { STATE_STARTING,       EVENT_CANCEL,           STATE_IDLE },
+    { STATE_TARING,         EVENT_TARED,            STATE_FEEDING },
+    { STATE_SHOT,           EVENT_START,            STATE_TARING },   // clicked again while running
+    { STATE_SHOT,           EVENT_STOP,             STATE_STOPPING },
+    { STATE_CHARACTERIZING, EVENT_CHARACTERIZED,    STATE_IDLE },
+    { STATE_AWAKE,          EVENT_SLEEP,            STATE_SLEEPING },
+    { STATE_SLEEPING,       EVENT_WAKE,             STATE_IDLE },
+};
+static constexpr int boardTransitionCount = sizeof(boardTransitions) / sizeof(boardTransitions[0]);
+static_assert(boardTransitionCount <= BoardStateMachine::maxTransitions, "too many transitions");
+
+// Mean post-stop mass per StopMode, to compare coasting and braking
+RTC_DATA_ATTR float rtcPostStopMass[2] = {0.0f, 0.0f};
+RTC_DATA_ATTR unsigned int rtcPostStopCount[2] = {0, 0};
+// Whether the Up press that wakes the board from deep sleep starts a shot, decided at sleep
+RTC_DATA_ATTR bool rtcWakeToFeed = false;
+// Hopper weight at the last pour check in deep sleep
+RTC_DATA_ATTR float rtcPourWeight = 0.0f;
+RTC_DATA_ATTR bool rtcPourWeightKnown = false;
+
 Board::Board()
     : motor(IN1MotorPin, IN2MotorPin),
     buzzer(buzzerPin),
     loadCell(HX_DOUT, HX_CLK, CALIBRATION_FACTOR),
     battery(BATTERYPIN_GPIO, batteryChannel, batteryAdcUnit),
-    buttonUp(buttonUpPin, BUTTON_PULLDOWN, true, 50),
-	buttonDown(buttonDownPin, BUTTON_PULLDOWN, true, 50) {}
+    buttons(50, 1000),
+    gestures(gestureTable.rows.data(), gestureTable.size),
+    flowController(0.0f, 100.0f),
+    characterizer(motor, loadCell),
+    pwmSweep(motor, characterizer),
+    pulseFeeder(motor),
+    stateMachine(boardStates, boardTransitions, boardTransitionCount, STATE_IDLE),
+    safety(motor),
+    startupSequence(*this),
+    sleepSequence(*this) {}
 
 void Board::setup() {
-    
+    stampBoot(BOOT_SETUP);
+    releaseSleepPins(sleepPins, sleepPinCount);
+    wakeCause = readWakeCause();
+    // short interactions take a minimal path and end in deep sleep
+    switch (wakeCause) {
+        case WAKE_TIMER:
+            if (HAS_LOADCELL && HAS_POURWAKE && !checkPour()) {
+                // nothing poured: back to sleep without bringing anything else up
+                prepareSleep();
+                esp_deep_sleep_start();
+            }
+            break;
+
+        case WAKE_BUTTON_DOWN:
+            if (HAS_BATTERYMONITOR) { chimeBatteryAndSleep(); }
+            break;
+
+        default:
+            break;
+    }
+    // the hopper changes while awake, the next sleep starts from a new weight
+    rtcPourWeightKnown = false;
+    wakeShot = shouldFeedOnWake();
+    // does not wait for a host, and a wake shot prints from the loop before the startup report
     Serial.begin(115200);
     motor.setup();
-    
-    delay(1500);
-    Serial.println("Starting up...");
-    printWakeupReason();
-
-    
-    Serial.println("Setting up motor");
+    stampBoot(BOOT_MOTOR);
 
     rtcMotorVoltage = rtcMotorVoltage < 0.0f ? motor.getMinVoltage() : rtcMotorVoltage;
 
     if (HAS_LOADCELL) {
         loadCell.setup();
-        Serial.println("Load cell detected");
-    }
-    else {
-        Serial.println("Load cell not detected");
+        beanProfiles.setup();
+        motor.calibrateSpeed(beanProfiles.getFlowModel());
     }
+    stampBoot(BOOT_LOADCELL);
 
     if (HAS_BUZZER) {
         buzzer.setup();
         speakerPtr = &buzzer;
-        Serial.println("Buzzer detected");
     }
     else {
         speakerPtr = &motor;
-        Serial.println("Buzzer not detected");
     }
     
-    if (HAS_BATTERYMONITOR) {
+    if (HAS_BATTERYMONITOR && !wakeShot) {
+        // measures the level in the background, the startup chime waits for it
         battery.setup();
-        batteryLevel = battery.getBatteryLevel();
-        Serial.println("Battery monitor detected");
+        motor.setSupplyVoltage(battery.getSupplyVoltage());
     }
-    else {
-        Serial.println("Battery monitor not detected");
+
+    buttons.addButton(buttonUpPin, BUTTON_PULLDOWN);   // BUTTON_UP
+    buttons.addButton(buttonDownPin, BUTTON_PULLDOWN); // BUTTON_DOWN
+    buttons.begin();
+
+    power.setup();
+    eventLoop.setup(power.isLightSleepEnabled());
+    eventLoop.addWakePin(BUTTON_UP_GPIO, HIGH, HAS_BUTTONBANK ? GPIO_INTR_DISABLE : GPIO_INTR_ANYEDGE);
+    eventLoop.addWakePin(BUTTON_DOWN_GPIO, HIGH, HAS_BUTTONBANK ? GPIO_INTR_DISABLE : GPIO_INTR_ANYEDGE);
+    buttons.setWakeHandler(&EventLoop::notify, &eventLoop);
+    if (HAS_LOADCELL && HAS_SAFETYCUTOFF) {
+        if (SAFETY_SIMULATION) { loadCell.setSimulatedFeed(safetySimulationRate); }
+        loadCell.startAcquisition(&Board::onLoadCellSample, this);
+    }
+    else if (HAS_LOADCELL) {
+        eventLoop.setSamplePin(HX_DOUT);
     }
+    stateMachine.begin();
+    stampBoot(BOOT_INPUT);
 
-	// Refresh buttons
-	rtc_gpio_hold_dis(BUTTON_DOWN_GPIO);  
+    // the wake press gives no click, ButtonEngine ignores a button that is down at begin()
+    if (wakeShot) { startShot(); }
 
-    buttonUp.releaseHandler(onRelease);
-    buttonUp.holdHandler(onHold, 1000);
+    // the buttons work from here on, the rest of the startup runs from the loop
+    startupSequence.start();
+}
+
+// Weighs the hopper, true once beans were poured in since the last check. The first check
+// of a sleep only takes the weight
+bool Board::checkPour() {
+    float weight;
+    loadCell.setup();
+    if (!loadCell.measureAfterPowerUp(weight)) { return false; }
+    bool poured = rtcPourWeightKnown && fabsf(weight - rtcPourWeight) >= pourThreshold;
+    pouredMass = poured ? fabsf(weight - rtcPourWeight) : 0.0f;
+    rtcPourWeight = weight;
+    rtcPourWeightKnown = true;
+    return poured;
+}
 
-    buttonDown.releaseHandler(onRelease);
-    buttonDown.holdHandler(onHold, 1000);
+// An Up wake, and the board went to sleep fit to feed
+bool Board::shouldFeedOnWake() const {
+    return wakeCause == WAKE_BUTTON_UP && rtcWakeToFeed;
+}
 
-    buttonUp.process();
-    buttonDown.process();
-    buttonUp.buttonstatus = BUTTON_IDLE;
-    buttonDown.buttonstatus = BUTTON_IDLE;
+WakeCause Board::readWakeCause() const {
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_EXT0:
+            // slept with a firmware that only woke on Up
+            return WAKE_BUTTON_UP;
+        case ESP_SLEEP_WAKEUP_EXT1: {
+            uint64_t pins = esp_sleep_get_ext1_wakeup_status();
+            // Up wins when both are down
+            bool down = (pins & (1ULL << BUTTON_DOWN_GPIO)) && !(pins & (1ULL << BUTTON_UP_GPIO));
+            return down ? WAKE_BUTTON_DOWN : WAKE_BUTTON_UP;
+        }
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return WAKE_TIMER;
+        default:
+            return WAKE_POWER_ON;
+    }
+}
 
-    if (HAS_BATTERYMONITOR && (batteryLevel == BATTERY_CRITICAL)) {
-        playBatteryCriticalChime(speakerPtr);
+// Down wake: the battery level chime, without serial, sensors or taring
+void Board::chimeBatteryAndSleep() {
+    motor.setup();
+    if (HAS_BUZZER) {
+        buzzer.setup();
+        speakerPtr = &buzzer;
     }
     else {
-        playStartupChime(speakerPtr);
+        speakerPtr = &motor;
     }
+    battery.setup();
+    while (battery.isMeasuring()) {
+        delay(battery.timeToNextStep());
+        battery.updateMeasurement();
+    }
+    batteryLevel = battery.getBatteryLevel();
+    playBatteryLevelChime(speakerPtr);
+    speakerPtr->flush();
+    sleepFromMinimalPath();
 }
 
-void Board::handleDoubleClick(Button& button, bool& pendingClick, unsigned long& clickStartTime) {
-    unsigned long now = millis();
+// Nothing else runs on a minimal path, so the sleep sequence is stepped here until the board is down
+void Board::sleepFromMinimalPath() {
+    sleepSequence.begin(false);
+    while (true) {
+        delay(sleepSequence.timeToNextStep());
+        sleepSequence.update();
+    }
+}
 
-    if (button.buttonstatus == BUTTON_CLICK) {
-        if (pendingClick && (now - clickStartTime <= doubleClickInterval)) {
-            button.buttonstatus = BUTTON_DOUBLE_CLICK;
-            pendingClick = false;
-        } 
-        else {
-            // Temporarily assign to idle to wait for second click decision
-            button.buttonstatus = BUTTON_IDLE;
-            pendingClick = true;
-            clickStartTime = now;
+void Board::stampBoot(BootStage stage) {
+    if (bootStamps[stage] == 0) { bootStamps[stage] = esp_timer_get_time(); }
+}
+
+void Board::printBootStages() const {
+    static const char* const names[BOOT_STAGE_COUNT] = { "setup", "motor", "load cell", "input", "first duty" };
+    Serial.print("Boot stages (ms since boot):");
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        if (bootStamps[i] == 0) { Serial.printf(" %s -", names[i]); }
+        else { Serial.printf(" %s %.1f", names[i], bootStamps[i] / 1e3); }
+    }
+    Serial.println();
+}
+
+// Acquisition task: the cutoff has decided before the loop hears of the sample
+void Board::onLoadCellSample(void* arg, float weight, int64_t readyTime) {
+    Board* board = static_cast<Board*>(arg);
+    board->safety.check(weight, readyTime);
+    EventLoop::notifySample(&board->eventLoop);
+}
+
+void Board::printConfiguration() {
+    Serial.println("Starting up...");
+    printWakeupReason();
+    Serial.println(HAS_LOADCELL ? "Load cell detected" : "Load cell not detected");
+    Serial.println(HAS_BUZZER ? "Buzzer detected" : "Buzzer not detected");
+    Serial.println(HAS_BATTERYMONITOR ? "Battery monitor detected" : "Battery monitor not detected");
+    if (SAFETY_SIMULATION) { Serial.printf("Safety simulation: load cell replaced by a %.1f g/s feed\n", safetySimulationRate); }
+    power.printConfiguration();
+}
+
+void Board::StartupSequence::step() {
+    switch (phase) {
+        case DEFERRED_SETUP:
+            // a wake shot is already feeding, the rest comes up behind it
+            if (board.wakeShot && HAS_BATTERYMONITOR) {
+                board.battery.setup();
+                board.motor.setSupplyVoltage(board.battery.getSupplyVoltage());
+            }
+            next(WAIT_SERIAL);
+            break;
+
+        case WAIT_SERIAL:
+            waitFor(serialWaitTime, REPORT);
+            break;
+
+        case REPORT:
+            board.printConfiguration();
+            if (board.wakeShot) { Serial.println("Wake press: feeding"); }
+            if (board.pouredMass > 0) { Serial.printf("Woken by beans poured in: %.1f g\n", board.pouredMass); }
+            // the wake shot has stamped its first duty by now
+            if (BOOT_PROFILING) { board.printBootStages(); }
+            next(WAIT_BATTERY);
+            break;
+
+        case WAIT_BATTERY:
+            if (HAS_BATTERYMONITOR && board.battery.isMeasuring()) {
+                waitFor(board.activeTickInterval, WAIT_BATTERY);
+                break;
+            }
+            next(CHIME);
+            break;
+
+        case CHIME:
+            if (HAS_BATTERYMONITOR && (board.batteryLevel == BATTERY_CRITICAL)) {
+                board.playBatteryCriticalChime(board.speakerPtr);
+            }
+            // the feeding wheel already says the board is awake
+            else if (!board.wakeShot) {
+                board.playStartupChime(board.speakerPtr);
+            }
+            finish();
+            break;
+    }
+}
+
+// Steps whatever sequence is due; the loop's deadline covers the next step of each
+void Board::runSequences() {
+    if (HAS_BATTERYMONITOR && battery.updateMeasurement()) {
+        batteryLevel = battery.getBatteryLevel();
+        if (batteryLevel == BATTERY_CRITICAL) { stateMachine.dispatch(EVENT_BATTERY_CRITICAL); }
+        if (batteryChimePending) {
+            batteryChimePending = false;
+            playBatteryLevelChime(speakerPtr);
         }
     }
+    if (HAS_LOADCELL && HAS_HOPPERCHECK) { updateHopperCheck(); }
+    startupSequence.update();
+    sleepSequence.update();
+}
 
-    if (pendingClick && (now - clickStartTime > doubleClickInterval)) {
-        button.buttonstatus = BUTTON_CLICK;
-        pendingClick = false;
+// Only while idle, anything else either reads the load cell itself or is going to sleep
+void Board::updateHopperCheck() {
+    if (!stateMachine.isIn(STATE_IDLE)) {
+        loadCell.cancelHopperCheck();
+        lastHopperCheck = millis();
+        return;
+    }
+    if (!loadCell.isCheckingHopper() && millis() - lastHopperCheck >= hopperCheckInterval) {
+        loadCell.startHopperCheck();
+        lastHopperCheck = millis();
+    }
+    if (loadCell.updateHopperCheck()) { reportHopperCheck(); }
+}
+
+void Board::reportHopperCheck() {
+    float weight;
+    if (!loadCell.getHopperWeight(weight)) {
+        Serial.println("Hopper check: no load cell reading");
+        return;
+    }
+    // the first pour check in deep sleep compares against this
+    rtcPourWeight = weight;
+    rtcPourWeightKnown = true;
+    if (loadCell.knowsEmptyWeight()) {
+        Serial.printf("Hopper check: %.1f g of beans%s\n", weight - rtcEmptyWeight, loadCell.hasBeans() ? "" : ", empty");
+    }
+    else {
+        Serial.printf("Hopper check: %.1f g\n", weight);
     }
 }
 
 void Board::updateButtons() {
-    // Update button response
-    buttonUp.process();
-    buttonDown.process();
+    // Events carry the time of the edge, however late the loop gets to them
+    gestures.setEnabled(enabledGestures());
+    ButtonEvent event;
+    while (buttons.poll(event)) {
+        // the pins are being powered down
+        if (sleepSequence.isCommitted()) { continue; }
+        if (sleepSequence.isRunning()) {
+            sleepSequence.cancel();
+            stateMachine.dispatch(EVENT_WAKE);
+            if (HAS_BATTERYMONITOR && batteryLevel == BATTERY_CRITICAL) { stateMachine.dispatch(EVENT_BATTERY_CRITICAL); }
+        }
+        lastButtonActiveTime = millis();
+        gestures.handle(event);
+        if (event.type == BUTTON_EVENT_PRESS && event.button == BUTTON_UP) {
+            startSpeculatively();
+        }
+    }
+}
+
+// An Up press from idle is most likely a click: start on the press instead of
+// after the click is recognised, and take it back if it becomes another gesture
+void Board::startSpeculatively() {
+    if (!stateMachine.isIn(STATE_READY)) { return; }
+    if (buttons.isPressed(BUTTON_DOWN)) { return; }
+    startShot(EVENT_PRESS_START);
+}
+
+void Board::cancelSpeculativeStart() {
+    safety.disarm();
+    motor.reset();
+    if (HAS_LOADCELL) {
+        beanProfiles.getFlowModel().endShot();
+        loadCell.reset();
+    }
+    stateMachine.dispatch(EVENT_CANCEL);
+}
 
-    // Double-click detection 
-    handleDoubleClick(buttonUp, pendingClickUp, clickUpStartTime);
-    handleDoubleClick(buttonDown, pendingClickDown, clickDownStartTime);
-    // Serial.print("Down button status: ");
-    // Serial.println(buttonDown.buttonstatus);
+// Only gestures that mean something now take part, so e.g. a Down click stops a
+// running motor at once instead of waiting out the double click gap
+uint32_t Board::enabledGestures() {
+    if (stateMachine.isIn(STATE_FAULT)) {
+        return GESTURE_BIT(GESTURE_UP_CLICK) | GESTURE_BIT(GESTURE_DOWN_CLICK) | GESTURE_BIT(GESTURE_DOWN_DOUBLE_CLICK);
+    }
+    if (stateMachine.isIn(STATE_CHARACTERIZING)) {
+        // only a Down click (abort) is accepted while characterising
+        return GESTURE_BIT(GESTURE_DOWN_CLICK);
+    }
+    uint32_t enabled = GESTURE_BIT(GESTURE_UP_CLICK) | GESTURE_BIT(GESTURE_UP_DOUBLE_CLICK) | GESTURE_BIT(GESTURE_DOWN_CLICK);
+    // a speculative start still counts as idle until its gesture is known
+    if (stateMachine.isIn(STATE_SHOT) && !stateMachine.isIn(STATE_STARTING)) { return enabled; }
+    enabled |= GESTURE_BIT(GESTURE_DOWN_DOUBLE_CLICK);
+    if (HAS_LOADCELL) {
+        enabled |= GESTURE_BIT(GESTURE_UP_TRIPLE_CLICK) | GESTURE_BIT(GESTURE_DOWN_HOLD) | GESTURE_BIT(GESTURE_UP_HOLD_DOWN_CLICK);
+    }
+    return enabled;
 }
 
 void Board::playBatteryLevelChime(Speaker* speaker) {
@@ -111,122 +418,193 @@ void Board::playBatteryLevelChime(Speaker* speaker) {
         playBatteryCriticalChime(speaker);
     }
     for (int i = 0; i < batteryLevel; ++i) {
-        speaker->makeSound(800, 300);
-        delay(150);
+        speaker->play(batteryLevelChime);
     }
 }
 
 void Board::playBatteryCriticalChime(Speaker* speaker) {
-    speaker->makeSound(1000, 150);
-    speaker->makeSound(800, 150);
-    speaker->makeSound(600, 200);
+    speaker->play(batteryCriticalChime, CHIME_PRIORITY_ALERT);
 }
 
 void Board::playStartupChime(Speaker* speaker) {
-    speaker->makeSound(1000, 150);
-    speaker->makeSound(1300, 150);
-    speaker->makeSound(1600, 150);
-    speaker->makeSound(2000, 200);
+    speaker->play(startupChime);
 }
 
 void Board::playDeepSleepChime(Speaker* speaker) {
-	speaker->makeSound(1800, 150);
-    speaker->makeSound(1400, 150);
-    speaker->makeSound(1000, 150);
-    speaker->makeSound(600, 300);
+    speaker->play(deepSleepChime);
 }
 
-bool Board::shouldSleep() {
-    unsigned long now = millis();
-    bool timeout = (now - lastMotorActiveTime > sleepTimeoutTime) && (now - lastButtonActiveTime > sleepTimeoutTime);
-	return timeout || buttonDown.buttonstatus == BUTTON_DOUBLE_CLICK;
+void Board::playProfileChime(Speaker* speaker) {
+    for (int i = 0; i <= beanProfiles.getIndex(); ++i) {
+        speaker->play(profileChime);
+    }
 }
 
-void Board::isolateRtcPin(gpio_num_t pin) {
-    rtc_gpio_init(pin);
-    rtc_gpio_isolate(pin);
+// Pulsed: two short beeps, continuous: one long
+void Board::playFeedModeChime(Speaker* speaker) {
+    if (beanProfiles.getFeedMode() == FEED_PULSED) {
+        speaker->play(pulsedFeedChime);
+    }
+    else {
+        speaker->play(continuousFeedChime);
+    }
 }
 
-void Board::configureRtcPin(gpio_num_t pin, rtc_gpio_mode_t mode, bool enablePullup, bool enablePulldown) {
-    rtc_gpio_init(pin);
-    if (enablePullup) {
-        rtc_gpio_pullup_en(pin);
-    } 
-    else {
-        rtc_gpio_pullup_dis(pin);
+void Board::playCharacterizationChime(Speaker* speaker, bool success) {
+    if (success) {
+        speaker->play(characterizationDoneChime);
     }
-    if (enablePulldown) {
-        rtc_gpio_pulldown_en(pin);
-    } 
     else {
-        rtc_gpio_pulldown_dis(pin);
+        speaker->play(characterizationFailedChime);
     }
-    rtc_gpio_set_direction(pin, mode);
 }
 
-void Board::enterDeepSleep() {
-    if (motor.getVoltage() != 0) { resetSystem(); }
-    delay(500);
-    playDeepSleepChime(speakerPtr);
+// The state's profile, raised while a chime or the brake drives the pins or input is pending
+PowerState Board::powerState() {
+    PowerState state = stateMachine.getConfig().power;
+    if (state != POWER_IDLE && state != POWER_WAITING) { return state; }
+    // a buzzer chime runs on LEDC without the motor, it needs the chime lock just the same
+    if (motor.isActive() || speakerPtr->isPlaying()) { return POWER_CHIME; }
+    if (gestures.isBusy() || buttons.isSettling()) { return POWER_WAITING; }
+    return state;
+}
 
-    // hx711 load cell
-    if (HAS_LOADCELL) {
-        configureRtcPin(HX711CLK_GPIO, RTC_GPIO_MODE_OUTPUT_ONLY, true, false);
-        pinMode(HX_CLK, OUTPUT);
-        digitalWrite(HX_CLK, LOW);
-        delayMicroseconds(1);
-        digitalWrite(HX_CLK, HIGH);
-        delayMicroseconds(100);
-        pinMode(HX_DOUT, INPUT);
+// ms the board has been idle for the sleep timeout, 0 while anything is going on
+unsigned long Board::idleTime() {
+    if (!stateMachine.isIn(STATE_IDLE) && !stateMachine.isIn(STATE_FAULT)) { return 0; }
+    return min(stateMachine.timeInState(), millis() - lastButtonActiveTime);
+}
+
+unsigned long Board::nextDeadline(unsigned long tick) {
+    unsigned long now = millis();
+    unsigned long deadline = ULONG_MAX;
+    if (tick > 0) {
+        deadline = tick;
     }
-    
-    // Battery
-    if (HAS_BATTERYMONITOR) {
-        // configureRtcPin(IN2_GPIO, RTC_GPIO_MODE_DISABLED, false, false);
-        pinMode(batteryPin, INPUT); 
-        isolateRtcPin(BATTERYPIN_GPIO);
+    else if (!sleepSequence.isRunning()) {
+        unsigned long idle = idleTime();
+        bool timeout = idle >= (unsigned long)sleepTimeoutTime;
+        deadline = timeout ? 0 : sleepTimeoutTime - idle + 1;
+    }
+    deadline = min(deadline, startupSequence.timeToNextStep());
+    deadline = min(deadline, sleepSequence.timeToNextStep());
+    if (HAS_BATTERYMONITOR) { deadline = min(deadline, battery.timeToNextStep()); }
+    if (HAS_LOADCELL && HAS_HOPPERCHECK && stateMachine.isIn(STATE_IDLE)) {
+        unsigned long sinceCheck = now - lastHopperCheck;
+        if (loadCell.isCheckingHopper()) { deadline = min(deadline, loadCell.timeToNextStep()); }
+        else { deadline = min(deadline, sinceCheck >= hopperCheckInterval ? 0 : hopperCheckInterval - sinceCheck); }
     }
+    if (LOOP_PROFILING) {
+        unsigned long sinceReport = now - lastLoopReport;
+        deadline = min(deadline, sinceReport >= loopReportInterval ? 0 : loopReportInterval - sinceReport);
+    }
+    return deadline;
+}
 
-    // Buzzer
-    if (HAS_BUZZER) {
-        // configureRtcPin(IN2_GPIO, RTC_GPIO_MODE_DISABLED, false, false);
-        pinMode(buzzerPin, OUTPUT);
-        digitalWrite(buzzerPin, LOW);
-        delay(10);
-        pinMode(buzzerPin, INPUT); 
-        isolateRtcPin(BUZZER_GPIO);
-    }
-
-    // Motor driver
-    pinMode(IN1MotorPin, OUTPUT);
-    digitalWrite(IN1MotorPin, LOW);
-    delay(10);
-    pinMode(IN1MotorPin, INPUT);
-
-    // configureRtcPin(IN2_GPIO, RTC_GPIO_MODE_DISABLED, false, false);
-    pinMode(IN2MotorPin, OUTPUT);
-    digitalWrite(IN2MotorPin, LOW);
-    delay(10);
-    pinMode(IN2MotorPin, INPUT);
-    isolateRtcPin(IN1_GPIO);
-    isolateRtcPin(IN2_GPIO);
-
-    // Button Down
-    // configureRtcPin(BUTTON_DOWN_GPIO, RTC_GPIO_MODE_DISABLED, false, false);
-    pinMode(buttonDownPin, INPUT);
-    isolateRtcPin(BUTTON_DOWN_GPIO);
-
-    // Wakeup config
-    configureRtcPin(BUTTON_UP_GPIO, RTC_GPIO_MODE_INPUT_ONLY, false, true);
-    esp_sleep_enable_ext0_wakeup(BUTTON_UP_GPIO, HIGH);
-
-    // Report
-    Serial.print("System idle for (s): ");
-    Serial.println(min((millis() - lastMotorActiveTime), (millis() - lastButtonActiveTime)) / 1000);
-
-    Serial.println("Going to deep sleep");
-    Serial.flush();
-    esp_deep_sleep_start();
+// Blocks until a button event, whatever else the state wakes on, or the next deadline
+void Board::waitForEvents() {
+    const BoardStateConfig& config = stateMachine.getConfig();
+    PowerState state = powerState();
+    power.setState(state);
+    unsigned long tick = config.tickInterval;
+    if (tick == 0 && state != POWER_IDLE) { tick = activeTickInterval; }
+    bool wantSample = HAS_LOADCELL && (config.wakeSources & LOOP_EVENT_SAMPLE);
+    if (HAS_LOADCELL) { loadCell.setConsumer(SAMPLES_BOARD, config.sampling); }
+    power.beginWait();
+    eventLoop.wait(nextDeadline(tick), power.allowsLightSleep(), wantSample);
+    power.endWait();
+
+    if (LOOP_PROFILING && millis() - lastLoopReport >= loopReportInterval) {
+        eventLoop.report();
+        power.report();
+        stateMachine.report();
+        if (HAS_SAFETYCUTOFF) { safety.report(); }
+        if (HAS_LOADCELL) { loadCell.report(); }
+        motor.report();
+        lastLoopReport = millis();
+    }
+}
+
+bool Board::shouldSleep() {
+    return !stateMachine.isIn(STATE_SLEEPING) && idleTime() > (unsigned long)sleepTimeoutTime;
+}
+
+// Starts the sleep sequence, the loop keeps running until the board is down
+void Board::enterDeepSleep() {
+    stateMachine.dispatch(EVENT_SLEEP);
+    if (!sleepSequence.isRunning()) { sleepSequence.begin(true); }
+}
+
+void Board::SleepSequence::begin(bool chime) {
+    withChime = chime;
+    start();
+}
+
+bool Board::SleepSequence::isCommitted() const {
+    return isRunning() && phase >= POWER_DOWN;
+}
+
+void Board::SleepSequence::step() {
+    switch (phase) {
+        case STOP:
+            if (!withChime) {
+                next(POWER_DOWN);
+                break;
+            }
+            // the chime needs the motor stopped, the brake only when it was running
+            if (board.motor.getVoltage() != 0) {
+                board.resetSystem();
+                waitFor(brakeTime, CHIME);
+            }
+            else {
+                next(CHIME);
+            }
+            break;
+
+        case CHIME:
+            board.playDeepSleepChime(board.speakerPtr);
+            next(CHIME_PLAYING);
+            break;
+
+        case CHIME_PLAYING:
+            if (board.speakerPtr->isPlaying()) { waitFor(pollInterval, CHIME_PLAYING); }
+            else { next(POWER_DOWN); }
+            break;
+
+        case POWER_DOWN:
+            rtcWakeToFeed = !(HAS_BATTERYMONITOR && board.batteryLevel == BATTERY_CRITICAL);
+
+            // Report
+            Serial.print("System idle for (s): ");
+            Serial.println(min(board.stateMachine.timeInState(), millis() - board.lastButtonActiveTime) / 1000);
+            board.power.report();
+            board.stateMachine.report();
+            if (HAS_SAFETYCUTOFF) { board.safety.report(); }
+            if (HAS_LOADCELL) { board.loadCell.report(); }
+            board.motor.report();
+
+            board.prepareSleep();
+            Serial.println("Going to deep sleep");
+            Serial.flush();
+            esp_deep_sleep_start();
+            break;
+    }
+}
+
+// The whole pin plan in one pass, then the wake sources; the last step before esp_deep_sleep_start()
+void Board::prepareSleep() {
+    esp_err_t results[sleepPinCount];
+    applySleepPins(sleepPins, sleepPinCount, results);
+    armWakeSources();
+    if (SLEEP_AUDIT) { auditSleepPins(sleepPins, sleepPinCount, results); }
+}
+
+// The wake pins are configured by the plan
+void Board::armWakeSources() {
+    esp_sleep_enable_ext1_wakeup(sleepWakeMask(sleepPins, sleepPinCount), ESP_EXT1_WAKEUP_ANY_HIGH);
+    // ext0 kept the RTC peripherals, and with them the pulldowns, powered by itself; ext1 does not
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    if (HAS_LOADCELL && HAS_POURWAKE) { esp_sleep_enable_timer_wakeup(pourCheckInterval); }
 }
 
 void Board::printWakeupReason() const {
@@ -241,96 +619,162 @@ void Board::printWakeupReason() const {
     }
 }
 
-void Board::onRelease(Button& button) {
-	switch (button.buttonstatus)
-	{
-		case BUTTON_IDLE:
-			button.buttonstatus = BUTTON_CLICK;
-			break;
-		case BUTTON_HOLD:
-			button.buttonstatus = BUTTON_IDLE;
-            break;
-		default:
-			break;
-    } 	
+float Board::getStartVoltage() {
+    if (HAS_LOADCELL) {
+        float voltage = beanProfiles.getFlowModel().voltageForRate(beanProfiles.getTargetRate());
+        if (voltage > 0.0f) {
+            return constrain(voltage, motor.getMinVoltage(), motor.getMaxVoltage());
+        }
+    }
+    return rtcMotorVoltage;
+}
+
+bool Board::isPulsedFeed() {
+    return HAS_LOADCELL && beanProfiles.getFeedMode() == FEED_PULSED;
+}
+
+// Holds change the target feed rate instead of the voltage
+bool Board::isRateControlled() {
+    return HAS_LOADCELL && (HAS_FLOWCONTROL || isPulsedFeed());
+}
+
+void Board::switchBeanProfile() {
+    lastButtonActiveTime = millis();
+    beanProfiles.next();
+    motor.calibrateSpeed(beanProfiles.getFlowModel());
+    playProfileChime(speakerPtr);
 }
 
-void Board::onHold(Button& button) {
-    button.buttonstatus = BUTTON_HOLD;
+void Board::startCharacterization() {
+    lastButtonActiveTime = millis();
+    if (!stateMachine.dispatch(EVENT_CHARACTERIZE)) { return; }
+    loadCell.reset();
+    if (HAS_PWMSWEEP) { pwmSweep.start(); }
+    else { characterizer.start(); }
 }
 
-void Board::handleUpClick() {
-    if (HAS_LOADCELL) { loadCell.reset(); }
+void Board::finishCharacterization() {
+    bool succeeded = HAS_PWMSWEEP ? pwmSweep.succeeded() : characterizer.succeeded();
+    if (succeeded && HAS_PWMSWEEP) {
+        motor.applyPwmFrequency(pwmSweep.getBestFrequency());
+        motor.applyCharacterization(pwmSweep.getBreakawayVoltage(), pwmSweep.getKeepRunningVoltage());
+    }
+    else if (succeeded) {
+        motor.applyCharacterization(characterizer.getBreakawayVoltage(), characterizer.getKeepRunningVoltage());
+    }
+    if (succeeded) {
+        motor.calibrateSpeed(beanProfiles.getFlowModel());
+        rtcMotorVoltage = max(rtcMotorVoltage, motor.getMinVoltage());
+    }
+    playCharacterizationChime(speakerPtr, succeeded);
+    stateMachine.dispatch(EVENT_CHARACTERIZED);
+}
+
+void Board::handleUpClick(BoardEvent event) {
+    if (HAS_LOADCELL) {
+        loadCell.reset();
+        beanProfiles.getFlowModel().beginShot(millis());
+    }
+    if (!stateMachine.isIn(STATE_SHOT)) {
+        flowController.setTarget(beanProfiles.getTargetRate());
+        if (HAS_SAFETYCUTOFF) { safety.arm(); }
+    }
+    float gain = motor.getRatePerSpeed();
+    if (gain > 0.0f) { flowController.setGain(gain); }
+    flowController.reset(motor.getSpeed(), millis());
     motor.setMotorStartTime();
-    delayStartTime = millis();
-    waitingAfterClick = true;
-    firstUpPress = false;
+    tareStartTime = millis();
+    stateMachine.dispatch(event);
 }
 
 void Board::handleButtonAction() {
-    if (HAS_BATTERYMONITOR && (batteryLevel == BATTERY_CRITICAL)) {
-        if(buttonUp.buttonstatus != BUTTON_IDLE || (buttonDown.buttonstatus != BUTTON_IDLE && buttonDown.buttonstatus != BUTTON_DOUBLE_CLICK)) {
-            playBatteryCriticalChime(speakerPtr);  
-            buttonUp.buttonstatus = BUTTON_IDLE;
-            buttonDown.buttonstatus = BUTTON_IDLE;
-        }
+    uint8_t gesture;
+    while (gestures.poll(gesture, millis())) {
+        handleGesture(gesture);
+    }
+    // the press came to nothing
+    if (stateMachine.isIn(STATE_STARTING) && !gestures.isBusy()) { cancelSpeculativeStart(); }
+    handleHolds();
+}
+
+void Board::startShot(BoardEvent event) {
+    stampBoot(BOOT_FIRST_DUTY);
+    // the last hopper check no longer holds
+    rtcPourWeightKnown = false;
+    bool newShot = !stateMachine.isIn(STATE_SHOT);
+    if (newShot && isPulsedFeed()) {
+        float pulseVoltage = min(motor.getMinVoltage() + pulseVoltageBoost, motor.getMaxVoltage());
+        motor.setVoltage(pulseVoltage, true);
+        handleUpClick(event);
+        pulseFeeder.start(pulseVoltage, millis());
+    }
+    else {
+        motor.setVoltage(newShot ? getStartVoltage() : motor.getMinVoltage(), true);
+        handleUpClick(event);
+    }
+}
+
+void Board::handleGesture(uint8_t gesture) {
+    lastButtonActiveTime = millis();
+    if (stateMachine.isIn(STATE_FAULT)) {
+        if (gesture == GESTURE_DOWN_DOUBLE_CLICK) { enterDeepSleep(); }
+        else { playBatteryCriticalChime(speakerPtr); }
         return;
     }
+    bool speculative = stateMachine.isIn(STATE_STARTING);
+    if (speculative && gesture != GESTURE_UP_CLICK && gesture != GESTURE_UP_DOUBLE_CLICK) {
+        cancelSpeculativeStart();
+    }
 
-	switch (buttonUp.buttonstatus) {
-        case BUTTON_HOLD:  
-            // Serial.print("Holding Up; Current Voltage: ");
-            // Serial.print("Holding Up; New Voltage: ");
-            // Serial.println(constrain(currVoltage + motor.getVoltageStep(), 0, motor.getBusVoltage()), 2);
-            lastButtonActiveTime = millis();
-            if (motor.getVoltage() > 0) {
-                motor.setVoltage(motor.getVoltage() + motor.getVoltageStep());
-            }
+    switch (gesture) {
+        case GESTURE_UP_CLICK:
+            // already running since the press
+            if (speculative) { stateMachine.dispatch(EVENT_START); }
+            else { startShot(); }
             break;
 
-        case BUTTON_CLICK:  // Click
-            // loadCell.tare();
-            // motor.setVoltage(IN1MotorPin, motor.getMinVoltage());
-            // buttonUp.buttonstatus = 0;
-            // break;
-            lastButtonActiveTime = millis();
-            motor.setVoltage(firstUpPress ? rtcMotorVoltage : motor.getMinVoltage(), true);
-            handleUpClick();
-            buttonUp.buttonstatus = BUTTON_IDLE;
+        case GESTURE_UP_DOUBLE_CLICK:
+            motor.stopPulsing();
+            motor.setVoltage(motor.getMaxVoltage(), true);
+            if (speculative) {
+                // upgrade in place, the shot started with the press
+                stateMachine.dispatch(EVENT_START);
+                flowController.reset(motor.getSpeed(), millis());
+            }
+            else {
+                handleUpClick();
+            }
             break;
 
-		case BUTTON_DOUBLE_CLICK:
-            lastButtonActiveTime = millis();
-			motor.setVoltage(motor.getMaxVoltage(), true);
-            handleUpClick();
-            buttonUp.buttonstatus = BUTTON_IDLE;
-			break;
-
-        default:
-            // No action needed
+        case GESTURE_UP_TRIPLE_CLICK:
+            toggleFeedMode();
             break;
-    }
 
-    switch (buttonDown.buttonstatus) {
-        case BUTTON_HOLD:  
-            lastButtonActiveTime = millis();
-            if (motor.getVoltage() > 0) {
-                float newVoltage = motor.getVoltage() - motor.getVoltageStep();
-                // ensure motor doesn't stop when holding down button
-                motor.setVoltage(max(newVoltage, motor.getMinVoltage()));
-            }
+        case GESTURE_UP_HOLD_DOWN_CLICK:
+            startCharacterization();
             break;
 
-        case BUTTON_CLICK:
-            lastButtonActiveTime = millis();
-            if (motor.getVoltage() > 0) {
+        case GESTURE_DOWN_CLICK:
+            if (stateMachine.isIn(STATE_CHARACTERIZING)) {
+                if (HAS_PWMSWEEP) { pwmSweep.abort(); }
+                else { characterizer.abort(); }
+            }
+            else if (stateMachine.isIn(STATE_SHOT)) {
                 resetSystem();
             }
             else if (HAS_BATTERYMONITOR) {
-                batteryLevel = battery.getBatteryLevel();
-                playBatteryLevelChime(speakerPtr);
+                // chimes from runSequences() once measured
+                battery.startMeasurement();
+                batteryChimePending = true;
             }
-            buttonDown.buttonstatus = BUTTON_IDLE;
+            break;
+
+        case GESTURE_DOWN_DOUBLE_CLICK:
+            enterDeepSleep();
+            break;
+
+        case GESTURE_DOWN_HOLD:
+            switchBeanProfile();
             break;
 
         default:
@@ -339,40 +783,206 @@ void Board::handleButtonAction() {
     }
 }
 
+// Holding a button while the wheel turns keeps stepping the speed or target rate
+void Board::handleHolds() {
+    if (!stateMachine.isIn(STATE_SHOT) || motor.getVoltage() == 0) { return; }
+
+    if (gestures.isHeld(BUTTON_UP)) {
+        lastButtonActiveTime = millis();
+        // holding Up from idle starts and speeds up, once a Down click can no longer
+        // turn the hold into the characterisation chord
+        bool chordPending = stateMachine.isIn(STATE_STARTING) && gestures.isChordPending(BUTTON_UP, millis());
+        if (!chordPending) {
+            if (stateMachine.isIn(STATE_STARTING)) { stateMachine.dispatch(EVENT_START); }
+            if (isRateControlled()) {
+                adjustFlowTarget(flowTargetStep);
+            }
+            else {
+                motor.setSpeed(motor.getSpeed() + motor.getSpeedStep());
+            }
+        }
+    }
+
+    if (gestures.isHeld(BUTTON_DOWN)) {
+        lastButtonActiveTime = millis();
+        if (isRateControlled()) {
+            adjustFlowTarget(-flowTargetStep);
+        }
+        else {
+            float newSpeed = motor.getSpeed() - motor.getSpeedStep();
+            // ensure motor doesn't stop when holding down button
+            motor.setSpeed(max(newSpeed, 0.0f));
+        }
+    }
+}
+
+void Board::toggleFeedMode() {
+    beanProfiles.toggleFeedMode();
+    playFeedModeChime(speakerPtr);
+}
+
 bool Board::shouldStopMotor() {
-    if (buttonUp.buttonstatus != BUTTON_IDLE || buttonDown.buttonstatus != BUTTON_IDLE){
+    if (gestures.isBusy()) {
         return false;
     }
     if (HAS_LOADCELL) {
-        return motor.shouldStop() || loadCell.shouldStop();
+        if (motor.isRecovering()) { return false; }
+        if (motor.shouldStop()) { return true; }
+        // a wake shot feeds before the converter settled: no flow, jam or hopper decision
+        // until the shot has its first settled reading
+        if (!loadCell.hasSettledWeight()) { return false; }
+        if (!loadCell.shouldStop()) { return false; }
+        // no flow: a bridge or jam while beans remain, or an empty hopper
+        if (!loadCell.knowsEmptyWeight()) { return !probeEmptyHopper(); }
+        if (loadCell.hasMassRemaining()) {
+            // a jam that outlasted every attempt stops the shot, the hopper is not empty
+            return !startJamRecovery();
+        }
+        loadCell.learnEmptyWeight();
+        return true;
     }
     return motor.shouldStop();
 }
 
+bool Board::startJamRecovery() {
+    if (!motor.startRecovery()) { return false; }
+    jamRecoveryActive = true;
+    return true;
+}
+
+// Without a learned empty weight a flow stop is a jam or an empty hopper. A single recovery
+// attempt tells them apart: it moves the beans of a jam, an empty hopper keeps its weight.
+// True while the attempt runs
+bool Board::probeEmptyHopper() {
+    if (motor.getRecoveryAttempts() == 0) {
+        jamProbeWeight = loadCell.getWeight();
+        return startJamRecovery();
+    }
+    // the attempt ended and the flow did not come back
+    if (jamRecoveryActive && fabsf(loadCell.getWeight() - jamProbeWeight) < jamProbeFlatMass) {
+        loadCell.learnEmptyWeight();
+    }
+    return false;
+}
+
+void Board::updateJamRecovery() {
+    if (!jamRecoveryActive) { return; }
+    if (motor.isRecovering()) {
+        // ignore the jolts of the pulses
+        loadCell.restartStopDetection();
+    }
+    else if (loadCell.isFlowing()) {
+        motor.recoveryCleared();
+        jamRecoveryActive = false;
+    }
+}
+
+void Board::adjustFlowTarget(float delta) {
+    unsigned long now = millis();
+    if (now - lastFlowTargetUpdate < flowTargetUpdateInterval) {
+        return;
+    }
+    flowController.setTarget(flowController.getTarget() + delta);
+    lastFlowTargetUpdate = now;
+    if (LOOP_PROFILING) {
+        Serial.print("Target feed rate (g/s): ");
+        Serial.println(flowController.getTarget(), 2);
+    }
+}
+
+void Board::updateFlowControl() {
+    if (motor.isRecovering()) { return; }
+    unsigned long now = millis();
+    float rate = loadCell.getFeedRate();
+    if (motor.isPulsing()) {
+        // the pulse voltage says nothing about the steady flow curve
+        pulseFeeder.update(flowController.getTarget(), rate, now);
+        return;
+    }
+    // every shot is recorded so the dead time is learned in manual mode too
+    flowController.record(motor.getSpeed(), rate, now);
+    beanProfiles.getFlowModel().observe(motor.getVoltage(), rate, now, flowController.getDeadTime());
+    if (HAS_FLOWCONTROL) {
+        motor.setSpeed(flowController.update(rate, now), true);
+    }
+}
+
 void Board::resetSystem() {
-    firstUpPress = true;
-    rtcMotorVoltage = motor.getVoltage();
+    stateMachine.dispatch(EVENT_STOP);
+    safety.disarm();
+    jamRecoveryActive = false;
+    if (!motor.isPulsing()) { rtcMotorVoltage = motor.getVoltage(); }
     // Serial.print("Saved rtc: ");
     // Serial.println(rtcMotorVoltage, 3);
+    // stop first, the bookkeeping below must not add to the overshoot
     motor.reset();
-    if (HAS_LOADCELL){ loadCell.reset(); }
+    if (HAS_LOADCELL) {
+        loadCell.beginPostStop();
+        flowController.identifyDeadTime();
+        FlowModel& flowModel = beanProfiles.getFlowModel();
+        flowModel.endShot();
+        // remember the wanted rate in flow units, the learned curve translates it for these beans
+        float wantedRate = isRateControlled() ? flowController.getTarget() : flowModel.getSteadyRate();
+        if (wantedRate > 0.0f) { beanProfiles.setTargetRate(wantedRate); }
+        beanProfiles.save();
+        motor.calibrateSpeed(flowModel);
+        loadCell.reset();
+    }
+}
+
+void Board::reportPostStopMass() {
+    int mode = motor.getStopMode();
+    float mass = loadCell.getPostStopMass();
+    unsigned int& count = rtcPostStopCount[mode];
+    count++;
+    rtcPostStopMass[mode] += (mass - rtcPostStopMass[mode]) / count;
+    Serial.printf("Post-stop mass (%s): %.2f g, mean %.2f g over %u stops\n",
+                  mode == STOP_BRAKE ? "brake" : "coast", mass, rtcPostStopMass[mode], count);
 }
 
 void Board::processFeedingCycle() {
-	if (HAS_LOADCELL && waitingAfterClick) {
+    if (HAS_BATTERYMONITOR) {
+        // battery sag feed-forward keeps the motor speed constant over a charge
+        battery.update();
+        motor.setSupplyVoltage(battery.getSupplyVoltage());
+    }
+    motor.update();
+    if (HAS_SAFETYCUTOFF && safety.hasTripped()) {
+        // the pins are already off, this ends the shot
+        resetSystem();
+        motor.clearCutoff();
+        safety.acknowledge();
+    }
+    stateMachine.dispatch(speakerPtr->isPlaying() ? EVENT_CHIME : EVENT_CHIME_DONE);
+
+    if (stateMachine.isIn(STATE_CHARACTERIZING)) {
+        bool running = HAS_PWMSWEEP ? pwmSweep.update() : characterizer.update();
+        if (!running) { finishCharacterization(); }
+        return;
+    }
+
+	if (stateMachine.isIn(STATE_TARING)) {
 		// delay for 1s after clicking button
 		// to avoid flucuations in readings
-		if(millis() - delayStartTime >= delayAfterClick) {
-			// reset to wait afte click
-			waitingAfterClick = false;
-			delayStartTime = millis();
+		// the converter was powered up with the press, its output settles well within the delay
+		if (!HAS_LOADCELL || (millis() - tareStartTime >= delayAfterClick && loadCell.isSettled())) {
+			stateMachine.dispatch(EVENT_TARED);
 		}
 	}
-	else {
+	else if (stateMachine.isIn(STATE_FEEDING)) {
 		if (motor.getVoltage() > 0) {
-			lastMotorActiveTime = millis();
-            if (HAS_LOADCELL){ loadCell.update(); }
+            if (HAS_LOADCELL) { updateJamRecovery(); }
+            if (HAS_LOADCELL && loadCell.update()) { updateFlowControl(); }
 			if (shouldStopMotor()) { resetSystem(); }
-		}   
+		}
+	}
+	else if (stateMachine.isIn(STATE_STOPPING)) {
+		if (HAS_LOADCELL && loadCell.updatePostStop()) {
+			reportPostStopMass();
+		}
+		// the brake is over and the beans have settled
+		if (!motor.isActive() && !(HAS_LOADCELL && loadCell.isMeasuringPostStop())) {
+			stateMachine.dispatch(EVENT_STOPPED);
+		}
 	}
 }
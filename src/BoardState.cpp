@@ -0,0 +1,71 @@
+#include "BoardState.h"
+#include "esp_timer.h"
+
+BoardStateMachine::BoardStateMachine(const BoardStateConfig* states, const BoardTransition* transitions,
+                                     int transitionCount, BoardState initial)
+	: states(states),
+	transitions(transitions),
+	transitionCount(min(transitionCount, maxTransitions)),
+	state(initial) {}
+
+void BoardStateMachine::begin() {
+	enteredAt = esp_timer_get_time();
+	accountedAt = enteredAt;
+	entries[state]++;
+}
+
+bool BoardStateMachine::dispatch(BoardEvent event) {
+	for (int i = 0; i < transitionCount; i++) {
+		const BoardTransition& transition = transitions[i];
+		if (transition.event != event || !isIn(transition.from)) { continue; }
+		if (transition.to == state) { return false; }
+		int64_t now = esp_timer_get_time();
+		account(now);
+		state = transition.to;
+		enteredAt = now;
+		entries[state]++;
+		taken[i]++;
+		return true;
+	}
+	return false;
+}
+
+BoardState BoardStateMachine::getState() const {
+	return state;
+}
+
+const BoardStateConfig& BoardStateMachine::getConfig() const {
+	return states[state];
+}
+
+bool BoardStateMachine::isIn(BoardState ancestor) const {
+	BoardState current = state;
+	while (true) {
+		if (current == ancestor) { return true; }
+		if (states[current].parent == current) { return false; }
+		current = states[current].parent;
+	}
+}
+
+unsigned long BoardStateMachine::timeInState() const {
+	return (esp_timer_get_time() - enteredAt) / 1000;
+}
+
+void BoardStateMachine::account(int64_t now) {
+	stateTime[state] += now - accountedAt;
+	accountedAt = now;
+}
+
+void BoardStateMachine::report() {
+	account(esp_timer_get_time());
+	Serial.printf("State %s for %.1f s\n", states[state].name, timeInState() / 1e3);
+	for (int i = 0; i < STATE_COUNT; i++) {
+		if (entries[i] == 0) { continue; }
+		Serial.printf("  %s: %.1f s, entered %lu times\n", states[i].name, stateTime[i] / 1e6, entries[i]);
+	}
+	for (int i = 0; i < transitionCount; i++) {
+		if (taken[i] == 0) { continue; }
+		const BoardTransition& transition = transitions[i];
+		Serial.printf("  %s -> %s: %lu\n", states[transition.from].name, states[transition.to].name, taken[i]);
+	}
+}
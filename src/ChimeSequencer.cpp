@@ -0,0 +1,128 @@
+#include "ChimeSequencer.h"
+
+void ChimeSequencer::beginChimes() {
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &ChimeSequencer::onTimer;
+    timerArgs.arg = this;
+    timerArgs.name = "chime";
+    esp_timer_create(&timerArgs, &timer);
+}
+
+void ChimeSequencer::makeSound(int frequency, int duration) {
+    Entry entry = {};
+    entry.count = 1;
+    entry.priority = CHIME_PRIORITY_NORMAL;
+    entry.single = {(uint16_t)max(frequency, 0), (uint16_t)max(duration, 0), 0};
+    enqueue(entry);
+}
+
+void ChimeSequencer::play(const ChimeNote* notes, size_t count, ChimePriority priority) {
+    if (count == 0) { return; }
+    Entry entry = {};
+    entry.notes = notes;
+    entry.count = min(count, (size_t)UINT8_MAX);
+    entry.priority = priority;
+    enqueue(entry);
+}
+
+void ChimeSequencer::enqueue(const Entry& entry) {
+    bool start = false;
+    bool cut = false;
+    portENTER_CRITICAL(&mux);
+    if (queued < queueSize) {
+        queue[queued] = entry;
+        queue[queued].order = nextOrder++;
+        queued++;
+        if (!playing) {
+            playing = true;
+            start = true;
+        }
+        else if (entry.priority > current.priority) {
+            preempt = true;
+            cut = true;
+        }
+    }
+    portEXIT_CRITICAL(&mux);
+
+    if (start) { step(); }
+    // a disarmed timer hands the sequence over; otherwise a step is in flight and
+    // the next one sees preempt
+    else if (cut && esp_timer_stop(timer) == ESP_OK) { step(); }
+}
+
+// Call with mux held
+bool ChimeSequencer::popHighest() {
+    if (queued == 0) { return false; }
+    int best = 0;
+    for (int i = 1; i < queued; i++) {
+        const Entry& entry = queue[i];
+        if (entry.priority > queue[best].priority ||
+            (entry.priority == queue[best].priority && (int32_t)(entry.order - queue[best].order) < 0)) {
+            best = i;
+        }
+    }
+    current = queue[best];
+    queue[best] = queue[--queued];
+    noteIndex = 0;
+    pendingGap = 0;
+    return true;
+}
+
+void ChimeSequencer::onTimer(void* arg) {
+    static_cast<ChimeSequencer*>(arg)->step();
+}
+
+// Runs on the caller for the first note, then on the timer task
+void ChimeSequencer::step() {
+    while (true) {
+        int frequency = 0;
+        uint32_t duration = 0;
+        bool hasStep = false;
+
+        portENTER_CRITICAL(&mux);
+        if (preempt) {
+            preempt = false;
+            noteIndex = current.count;
+            pendingGap = 0;
+        }
+        if (pendingGap > 0) {
+            duration = pendingGap;
+            pendingGap = 0;
+            hasStep = true;
+        }
+        else if (noteIndex < current.count || popHighest()) {
+            const ChimeNote& note = current.notes ? current.notes[noteIndex] : current.single;
+            noteIndex++;
+            frequency = note.frequency;
+            duration = note.duration;
+            pendingGap = note.gap;
+            hasStep = true;
+        }
+        portEXIT_CRITICAL(&mux);
+
+        if (hasStep) {
+            playTone(frequency);
+            esp_timer_start_once(timer, (uint64_t)max(duration, (uint32_t)1) * 1000ULL);
+            return;
+        }
+
+        playTone(0);
+        // a chime queued while the tone was silenced still has to play
+        portENTER_CRITICAL(&mux);
+        bool more = queued > 0;
+        if (!more) {
+            playing = false;
+            current = {};
+        }
+        portEXIT_CRITICAL(&mux);
+        if (!more) { return; }
+    }
+}
+
+void ChimeSequencer::flush() {
+    while (playing) { delay(1); }
+}
+
+bool ChimeSequencer::isPlaying() const {
+    return playing;
+}
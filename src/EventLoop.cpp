@@ -0,0 +1,104 @@
+#include "EventLoop.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+void EventLoop::setup(bool lightSleepEnabled) {
+	events = xEventGroupCreate();
+	this->lightSleepEnabled = lightSleepEnabled;
+	if (lightSleepEnabled) { esp_sleep_enable_gpio_wakeup(); }
+	waitStart = esp_timer_get_time();
+}
+
+void EventLoop::addWakePin(gpio_num_t pin, int activeLevel, gpio_int_type_t interruptType) {
+	if (numWakePins >= maxWakePins) { return; }
+	wakePins[numWakePins] = pin;
+	wakeLevels[numWakePins] = activeLevel;
+	wakeInterruptTypes[numWakePins] = interruptType;
+	numWakePins++;
+}
+
+void EventLoop::setSamplePin(int pin) {
+	samplePin = pin;
+	attachInterruptArg(pin, &EventLoop::onSampleReady, this, FALLING);
+	// DOUT also toggles while the HX711 is read out, so the interrupt is armed per wait
+	gpio_intr_disable((gpio_num_t)pin);
+}
+
+void EventLoop::armWakePins() {
+	for (int i = 0; i < numWakePins; i++) {
+		gpio_wakeup_enable(wakePins[i], wakeLevels[i] ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+	}
+	wakeArmed = true;
+}
+
+void IRAM_ATTR EventLoop::disarmWakePins() {
+	if (!wakeArmed.exchange(false)) { return; }
+	for (int i = 0; i < numWakePins; i++) {
+		gpio_wakeup_disable(wakePins[i]);
+		gpio_set_intr_type(wakePins[i], wakeInterruptTypes[i]);
+	}
+}
+
+void IRAM_ATTR EventLoop::notify(void* arg) {
+	EventLoop* loop = static_cast<EventLoop*>(arg);
+	if (xPortInIsrContext()) {
+		// a level interrupt would fire again as soon as this returns
+		loop->disarmWakePins();
+		BaseType_t woken = pdFALSE;
+		xEventGroupSetBitsFromISR(loop->events, LOOP_EVENT_BUTTON, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+	else {
+		xEventGroupSetBits(loop->events, LOOP_EVENT_BUTTON);
+	}
+}
+
+void EventLoop::notifySample(void* arg) {
+	EventLoop* loop = static_cast<EventLoop*>(arg);
+	if (loop->sampleWanted) { xEventGroupSetBits(loop->events, LOOP_EVENT_SAMPLE); }
+}
+
+void IRAM_ATTR EventLoop::onSampleReady(void* arg) {
+	EventLoop* loop = static_cast<EventLoop*>(arg);
+	gpio_intr_disable((gpio_num_t)loop->samplePin);
+	BaseType_t woken = pdFALSE;
+	xEventGroupSetBitsFromISR(loop->events, LOOP_EVENT_SAMPLE, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+EventBits_t EventLoop::wait(unsigned long timeout, bool lightSleep, bool wantSample) {
+	int64_t start = esp_timer_get_time();
+	runTime += start - waitStart;
+	maxRunTime = max(maxRunTime, start - waitStart);
+
+	sampleWanted = wantSample;
+	bool armSample = wantSample && samplePin >= 0;
+	if (armSample) {
+		// a conversion that is already waiting gives no falling edge
+		if (digitalRead(samplePin) == LOW) { xEventGroupSetBits(events, LOOP_EVENT_SAMPLE); }
+		else { gpio_intr_enable((gpio_num_t)samplePin); }
+	}
+	if (lightSleepEnabled && lightSleep) { armWakePins(); }
+
+	EventBits_t bits = xEventGroupWaitBits(events, LOOP_EVENT_BUTTON | LOOP_EVENT_SAMPLE,
+	                                       pdTRUE, pdFALSE, pdMS_TO_TICKS(min(timeout, maxTimeout)));
+
+	disarmWakePins();
+	if (armSample) { gpio_intr_disable((gpio_num_t)samplePin); }
+
+	waitStart = esp_timer_get_time();
+	waitTime += waitStart - start;
+	wakeups++;
+	return bits;
+}
+
+void EventLoop::report() {
+	int64_t awake = runTime + waitTime;
+	if (awake <= 0) { return; }
+	Serial.printf("Loop: running %.2f%% of %.1f s awake, %lu wakeups, longest pass %.1f ms\n",
+	              100.0 * runTime / awake, awake / 1e6, wakeups, maxRunTime / 1e3);
+	runTime = 0;
+	maxRunTime = 0;
+	waitTime = 0;
+	wakeups = 0;
+}
@@ -0,0 +1,133 @@
+#include "FlowController.h"
+// Apparent dead time learned from previous shots
+RTC_DATA_ATTR float rtcDeadTime = -1.0f;
+
+FlowController::FlowController(float minDrive, float maxDrive)
+	: minDrive(minDrive), maxDrive(maxDrive) {}
+
+void FlowController::reset(float startDrive, unsigned long now) {
+	drive = startDrive;
+	// bumpless start: zero error keeps the current drive
+	integral = startDrive - minDrive;
+	// motor starts from standstill, so no flow is in transit
+	modelRate = 0;
+	modelInd = 0;
+	modelObsCnt = 0;
+	lastUpdateTime = now;
+	shotObsCnt = 0;
+}
+
+void FlowController::setTarget(float rate) {
+	targetRate = max(rate, minTargetRate);
+}
+
+float FlowController::getTarget() const {
+	return targetRate;
+}
+
+void FlowController::setGain(float newGain) {
+	gain = max(newGain, minGain);
+}
+
+float FlowController::getDeadTime() const {
+	return rtcDeadTime < 0.0f ? defaultDeadTime : rtcDeadTime;
+}
+
+float FlowController::delayedModelRate(unsigned long now) const {
+	unsigned long deadTimeMs = (unsigned long)(getDeadTime() * 1000.0f);
+	// newest model output that is at least one dead time old
+	for (int i = 1; i <= modelObsCnt; ++i) {
+		int ind = (modelInd - i + modelHistorySize) % modelHistorySize;
+		if (now - modelHistoryTime[ind] >= deadTimeMs) {
+			return modelHistory[ind];
+		}
+	}
+	return 0.0f;
+}
+
+float FlowController::update(float measuredRate, unsigned long now) {
+	float dt = (now - lastUpdateTime) / 1000.0f;
+	if (dt <= 0) { return drive; }
+	lastUpdateTime = now;
+
+	// Undelayed model, driven by the drive applied over the last interval
+	float input = max(drive - minDrive, 0.0f);
+	modelRate += dt / (timeConstant + dt) * (gain * input - modelRate);
+
+	modelHistory[modelInd] = modelRate;
+	modelHistoryTime[modelInd] = now;
+	modelInd = (modelInd + 1) % modelHistorySize;
+	if (modelObsCnt < modelHistorySize) modelObsCnt++;
+
+	// Smith predictor: replace the delayed model output in the measurement by the undelayed one
+	float predictedRate = measuredRate - delayedModelRate(now) + modelRate;
+
+	// PI tuned on the delay free model (IMC)
+	float kp = timeConstant / (gain * closedLoopTime);
+	float ki = kp / timeConstant;
+	float error = targetRate - predictedRate;
+
+	// anti-windup: at rest the integral is the drive above minDrive, so it is kept within the
+	// drive range. Freezing it instead left it wherever saturation began, often far from the
+	// drive the target needs, and the rate undershot once the drive came back into range
+	integral = constrain(integral + ki * error * dt, 0.0f, maxDrive - minDrive);
+
+	drive = constrain(minDrive + kp * error + integral, minDrive, maxDrive);
+	return drive;
+}
+
+void FlowController::record(float appliedDrive, float measuredRate, unsigned long now) {
+	if (shotObsCnt >= shotHistorySize) { return; }
+	if (shotObsCnt == 0) { firstRecordTime = now; }
+	driveHistory[shotObsCnt] = appliedDrive;
+	rateHistory[shotObsCnt] = measuredRate;
+	lastRecordTime = now;
+	shotObsCnt++;
+}
+
+void FlowController::identifyDeadTime() {
+	const int minObservations = 8;
+	if (shotObsCnt < minObservations) {
+		shotObsCnt = 0;
+		return;
+	}
+	float avgDt = (lastRecordTime - firstRecordTime) / 1000.0f / (shotObsCnt - 1);
+	int maxLag = min((int)(maxDeadTime / avgDt), shotObsCnt / 2);
+
+	// Lag whose model response best matches the measured rate changes (normalised cross correlation),
+	// so the first order lag is not mistaken for dead time
+	float alphaModel = avgDt / (timeConstant + avgDt);
+	float bestCorr = 0.0f;
+	int bestLag = -1;
+	for (int lag = 0; lag <= maxLag; ++lag) {
+		float sxy = 0.0f, sxx = 0.0f, syy = 0.0f;
+		float model = 0.0f;
+		float prevModel = 0.0f;
+		for (int i = 0; i < shotObsCnt; ++i) {
+			float delayedDrive = i >= lag ? driveHistory[i - lag] : driveHistory[0];
+			model += alphaModel * (max(delayedDrive - minDrive, 0.0f) - model);
+			if (i > 0) {
+				float dm = model - prevModel;
+				float dr = rateHistory[i] - rateHistory[i - 1];
+				sxy += dm * dr;
+				sxx += dm * dm;
+				syy += dr * dr;
+			}
+			prevModel = model;
+		}
+		if (sxx <= 0.0f || syy <= 0.0f) { continue; }
+		float corr = sxy / sqrtf(sxx * syy);
+		if (corr > bestCorr) {
+			bestCorr = corr;
+			bestLag = lag;
+		}
+	}
+	shotObsCnt = 0;
+
+	// no drive change during the shot, or nothing clearly caused by it
+	if (bestLag < 0 || bestCorr < minCorrelation) { return; }
+
+	float deadTime = bestLag * avgDt;
+	rtcDeadTime = rtcDeadTime < 0.0f ? deadTime : (1.0f - learningRate) * rtcDeadTime + learningRate * deadTime;
+	Serial.print("Identified dead time (s): "); Serial.println(rtcDeadTime, 2);
+}
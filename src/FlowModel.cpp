@@ -0,0 +1,121 @@
+#include "FlowModel.h"
+
+void FlowModel::reset() {
+	curve.version = curveVersion;
+	curve.rate.fill(0.0f);
+	curve.count.fill(0);
+	modified = false;
+}
+
+void FlowModel::beginShot(unsigned long now) {
+	lastVoltage = -1.0f;
+	voltageChangeTime = now;
+	steadyRate = -1.0f;
+	pendingCnt = 0;
+}
+
+void FlowModel::endShot() {
+	pendingCnt = 0;
+}
+
+int FlowModel::binIndex(float voltage) const {
+	int ind = (int)lroundf((voltage - binMinVoltage) / binWidth);
+	return (ind < 0 || ind >= numBins) ? -1 : ind;
+}
+
+float FlowModel::binVoltage(int ind) const {
+	return binMinVoltage + ind * binWidth;
+}
+
+void FlowModel::observe(float voltage, float rate, unsigned long now, float deadTime) {
+	while (pendingCnt > 0 && now - pending[pendingHead].time >= tailGuardTime) {
+		commit(pending[pendingHead]);
+		pendingHead = (pendingHead + 1) % pendingSize;
+		pendingCnt--;
+	}
+
+	if (fabsf(voltage - lastVoltage) > voltageEpsilon) {
+		lastVoltage = voltage;
+		voltageChangeTime = now;
+		return;
+	}
+	// only steady state samples: wait out the dead time and the settling of the rate
+	float settleTime = deadTime + settleTimeConstants * timeConstant;
+	if (now - voltageChangeTime < (unsigned long)(settleTime * 1000.0f)) { return; }
+
+	int ind = binIndex(voltage);
+	if (ind < 0 || pendingCnt >= pendingSize) { return; }
+	Sample& sample = pending[(pendingHead + pendingCnt) % pendingSize];
+	sample.bin = ind;
+	sample.rate = rate;
+	sample.time = now;
+	pendingCnt++;
+}
+
+void FlowModel::commit(const Sample& sample) {
+	steadyRate = sample.rate;
+	uint16_t& count = curve.count[sample.bin];
+	float weight = max(1.0f / (count + 1), learningRate);
+	curve.rate[sample.bin] = (1.0f - weight) * curve.rate[sample.bin] + weight * sample.rate;
+	if (count < maxCount) count++;
+	modified = true;
+}
+
+float FlowModel::voltageForRate(float rate) const {
+	float envelope = 0.0f;
+	int prev = -1;
+	for (int i = 0; i < numBins; ++i) {
+		if (curve.count[i] == 0) { continue; }
+		float prevEnvelope = envelope;
+		envelope = max(envelope, curve.rate[i]);
+		if (envelope >= rate) {
+			if (prev < 0 || envelope <= prevEnvelope) { return binVoltage(i); }
+			float frac = (rate - prevEnvelope) / (envelope - prevEnvelope);
+			return binVoltage(prev) + frac * (binVoltage(i) - binVoltage(prev));
+		}
+		prev = i;
+	}
+	return -1.0f;
+}
+
+float FlowModel::rateAt(float voltage) const {
+	float envelope = 0.0f;
+	float prevEnvelope = 0.0f;
+	int prev = -1;
+	for (int i = 0; i < numBins; ++i) {
+		if (curve.count[i] == 0) { continue; }
+		envelope = max(envelope, curve.rate[i]);
+		if (binVoltage(i) >= voltage) {
+			if (prev < 0) { return voltage > binVoltage(i) - binWidth / 2 ? envelope : -1.0f; }
+			float frac = (voltage - binVoltage(prev)) / (binVoltage(i) - binVoltage(prev));
+			return prevEnvelope + frac * (envelope - prevEnvelope);
+		}
+		prevEnvelope = envelope;
+		prev = i;
+	}
+	if (prev >= 0 && voltage < binVoltage(prev) + binWidth / 2) { return envelope; }
+	return -1.0f;
+}
+
+float FlowModel::getSteadyRate() const {
+	return steadyRate;
+}
+
+bool FlowModel::isModified() const {
+	return modified;
+}
+
+bool FlowModel::load(Preferences& prefs, const char* key) {
+	reset();
+	if (prefs.getBytesLength(key) != sizeof(Curve)) { return false; }
+	Curve stored;
+	prefs.getBytes(key, &stored, sizeof(Curve));
+	if (stored.version != curveVersion) { return false; }
+	curve = stored;
+	return true;
+}
+
+void FlowModel::save(Preferences& prefs, const char* key) {
+	prefs.putBytes(key, &curve, sizeof(Curve));
+	modified = false;
+}
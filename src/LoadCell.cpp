@@ -1,4 +1,9 @@
 #include "LoadCell.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+// Absolute weight of the empty hopper, learned from shots that ran empty
+RTC_DATA_ATTR float rtcEmptyWeight = 0.0f;
+RTC_DATA_ATTR bool rtcEmptyWeightKnown = false;
 
 LoadCell::LoadCell(int doutPin, int clkPin, float cf, float a)
 	: DOUT(doutPin), CLK(clkPin), calibrationFactor(cf), alpha(a) {}
@@ -19,51 +24,319 @@ void LoadCell::reset() {
 }
 
 void LoadCell::setup() {
+	poweredAt = esp_timer_get_time();
+	settledAt = poweredAt + settleTime * 1000;
+	powerUps++;
 	scale.begin(DOUT, CLK);
 	scale.set_scale(calibrationFactor);
+	// stays powered until the first setConsumer(), the minimal wake path measures right away
 }
 
 bool LoadCell::nonBlockingReadWeight() {
-	if (cnt++ < numReadings) {
-		tallySum += scale.get_units();
+	if (cnt < numReadings) {
+		// an average starts from fresh conversions, not ones queued since the last
+		if (cnt == 0 && !batchOpen) {
+			discardSamples();
+			batchOpen = true;
+		}
+		float weight;
+		if (!takeSample(weight)) { return false; }
+		tallySum += weight;
+		cnt++;
 		return false;
 	}
 	else {
 		avgWeight = tallySum / numReadings;
 		cnt = 0;
 		tallySum = 0.0f;
+		batchOpen = false;
 		return true;
 	}
 }
 
+bool LoadCell::readSample(float& weight) {
+	if (acquisitionTask != nullptr) { return popSample(weight); }
+	if (!isSettled() || !scale.is_ready()) { return false; }
+	weight = scale.get_units();
+	return true;
+}
+
+// The next conversion, queued by the acquisition task or read directly, waiting for the converter
+bool LoadCell::takeSample(float& weight) {
+	if (acquisitionTask != nullptr) { return popSample(weight); }
+	if (!isSettled()) { return false; }
+	weight = scale.get_units();
+	return true;
+}
+
+void LoadCell::startAcquisition(SampleListener listener, void* arg) {
+	this->listener = listener;
+	listenerArg = arg;
+	// core 0, away from the loop
+	xTaskCreatePinnedToCore(&LoadCell::acquisitionEntry, "loadCell", acquisitionStackSize, this,
+	                        acquisitionPriority, &acquisitionTask, 0);
+	attachInterruptArg(DOUT, &LoadCell::onDataReady, this, FALLING);
+	// DOUT also toggles while the HX711 is read out, so the interrupt is armed per conversion
+	gpio_intr_disable((gpio_num_t)DOUT);
+}
+
+void LoadCell::setConsumer(SampleConsumer consumer, bool wanted) {
+	uint8_t previous = wanted ? consumers.fetch_or(consumer) : consumers.fetch_and(~consumer);
+	bool before = previous != 0;
+	bool after = consumers != 0;
+	if (acquisitionTask != nullptr) {
+		// the task owns CLK, it switches between conversions
+		if (before != after) { xTaskNotifyGive(acquisitionTask); }
+	}
+	else if (after != powered) {
+		applyPower(after);
+	}
+}
+
+void LoadCell::applyPower(bool on) {
+	if (on == powered) { return; }
+	if (on) { scale.power_up(); }
+	else { scale.power_down(); }
+	int64_t now = esp_timer_get_time();
+	portENTER_CRITICAL(&sampleMux);
+	if (on) {
+		poweredAt = now;
+		settledAt = now + settleTime * 1000;
+		powerUps++;
+	}
+	else {
+		onTime += now - poweredAt;
+		settledAt = 0;
+		sampleCount = 0;
+	}
+	portEXIT_CRITICAL(&sampleMux);
+	powered = on;
+}
+
+bool LoadCell::settledBy(int64_t time) const {
+	portENTER_CRITICAL(&sampleMux);
+	int64_t settled = settledAt;
+	portEXIT_CRITICAL(&sampleMux);
+	return settled != 0 && time >= settled;
+}
+
+bool LoadCell::isSettled() const {
+	return settledBy(esp_timer_get_time());
+}
+
+void LoadCell::report() {
+	int64_t now = esp_timer_get_time();
+	portENTER_CRITICAL(&sampleMux);
+	int64_t on = onTime + (settledAt != 0 ? now - poweredAt : 0);
+	portEXIT_CRITICAL(&sampleMux);
+	Serial.printf("Load cell converter: on %.1f s of %.1f s awake (%.0f%%), %lu power ups, "
+	              "%lu unsettled conversions dropped, %lu hopper checks\n",
+	              on / 1e6, now / 1e6, 100.0 * on / max(now, (int64_t)1), powerUps, unsettledSamples, hopperChecks);
+}
+
+void LoadCell::startHopperCheck() {
+	if (!hopperCheck.isRunning()) { hopperCheck.begin(); }
+}
+
+void LoadCell::cancelHopperCheck() {
+	if (!hopperCheck.isRunning()) { return; }
+	hopperCheck.cancel();
+	setConsumer(SAMPLES_HOPPER_CHECK, false);
+}
+
+bool LoadCell::updateHopperCheck() {
+	if (!hopperCheck.isRunning()) { return false; }
+	return !hopperCheck.update();
+}
+
+bool LoadCell::isCheckingHopper() const {
+	return hopperCheck.isRunning();
+}
+
+unsigned long LoadCell::timeToNextStep() const {
+	return hopperCheck.timeToNextStep();
+}
+
+bool LoadCell::getHopperWeight(float& weight) const {
+	weight = hopperWeight;
+	return hopperWeightKnown;
+}
+
+bool LoadCell::hasBeans() const {
+	return !hopperWeightKnown || !rtcEmptyWeightKnown || hopperWeight - rtcEmptyWeight > minRemainingMass;
+}
+
+void LoadCell::HopperCheck::begin() {
+	readings = 0;
+	sum = 0.0f;
+	start();
+}
+
+void LoadCell::HopperCheck::step() {
+	switch (phase) {
+		case SETTLE:
+			cell.setConsumer(SAMPLES_HOPPER_CHECK, true);
+			readStart = millis() + cell.settleTime;
+			waitFor(cell.settleTime, READ);
+			break;
+
+		case READ: {
+			float weight;
+			while (readings < cell.hopperReadings && cell.readSample(weight)) {
+				sum += weight;
+				readings++;
+			}
+			if (readings < cell.hopperReadings && millis() - readStart < cell.hopperReadTimeout) {
+				waitFor(cell.hopperPollInterval, READ);
+				break;
+			}
+			cell.setConsumer(SAMPLES_HOPPER_CHECK, false);
+			cell.hopperWeightKnown = readings == cell.hopperReadings;
+			if (cell.hopperWeightKnown) { cell.hopperWeight = sum / readings; }
+			cell.hopperChecks++;
+			finish();
+			break;
+		}
+	}
+}
+
+bool LoadCell::measureAfterPowerUp(float& weight) {
+	applyPower(true);
+	// the first conversion after power up has not settled
+	if (!scale.wait_ready_timeout(powerUpTimeout)) { return false; }
+	scale.read();
+	if (!scale.wait_ready_timeout(powerUpTimeout)) { return false; }
+	weight = scale.get_units(powerUpReadings);
+	return true;
+}
+
+void LoadCell::setSimulatedFeed(float rate) {
+	simulatedRate = rate;
+}
+
+void LoadCell::acquisitionEntry(void* arg) {
+	static_cast<LoadCell*>(arg)->acquisitionLoop();
+}
+
+void IRAM_ATTR LoadCell::onDataReady(void* arg) {
+	LoadCell* cell = static_cast<LoadCell*>(arg);
+	gpio_intr_disable((gpio_num_t)cell->DOUT);
+	cell->sampleReadyTime = esp_timer_get_time();
+	BaseType_t woken = pdFALSE;
+	vTaskNotifyGiveFromISR(cell->acquisitionTask, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+void LoadCell::acquisitionLoop() {
+	while (true) {
+		bool wanted = consumers != 0;
+		if (wanted != powered) {
+			applyPower(wanted);
+			simulationStart = esp_timer_get_time();
+		}
+		if (!powered) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		float weight;
+		int64_t readyTime;
+		if (!acquire(weight, readyTime)) { continue; }
+		if (!settledBy(readyTime)) {
+			unsettledSamples++;
+			continue;
+		}
+		pushSample(weight);
+		if (listener) { listener(listenerArg, weight, readyTime); }
+	}
+}
+
+bool LoadCell::acquire(float& weight, int64_t& readyTime) {
+	if (simulatedRate > 0) {
+		vTaskDelay(pdMS_TO_TICKS(simulatedSamplePeriod));
+		readyTime = esp_timer_get_time();
+		weight = simulatedStartMass - simulatedRate * (readyTime - simulationStart) / 1e6f;
+		return true;
+	}
+	// a conversion that is already waiting gives no falling edge
+	if (digitalRead(DOUT) == LOW) {
+		readyTime = esp_timer_get_time();
+	}
+	else {
+		gpio_intr_enable((gpio_num_t)DOUT);
+		bool notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(acquisitionTimeout)) > 0;
+		gpio_intr_disable((gpio_num_t)DOUT);
+		// also woken by setConsumer()
+		if (!notified || digitalRead(DOUT) != LOW) { return false; }
+		readyTime = sampleReadyTime;
+	}
+	weight = scale.get_units();
+	return true;
+}
+
+// Drops the oldest when the loop falls behind
+void LoadCell::pushSample(float weight) {
+	portENTER_CRITICAL(&sampleMux);
+	sampleQueue[(sampleHead + sampleCount) % sampleQueueSize] = weight;
+	if (sampleCount < sampleQueueSize) { sampleCount++; }
+	else { sampleHead = (sampleHead + 1) % sampleQueueSize; }
+	portEXIT_CRITICAL(&sampleMux);
+}
+
+bool LoadCell::popSample(float& weight) {
+	bool available = false;
+	portENTER_CRITICAL(&sampleMux);
+	if (sampleCount > 0) {
+		weight = sampleQueue[sampleHead];
+		sampleHead = (sampleHead + 1) % sampleQueueSize;
+		sampleCount--;
+		available = true;
+	}
+	portEXIT_CRITICAL(&sampleMux);
+	return available;
+}
+
+void LoadCell::discardSamples() {
+	portENTER_CRITICAL(&sampleMux);
+	sampleCount = 0;
+	portEXIT_CRITICAL(&sampleMux);
+}
+
 void LoadCell::start(unsigned long now) {
 	if (!nonBlockingReadWeight()) { return; }
-	// non blocking tare
-	scale.set_offset(avgWeight);
-	// non blocking average weight
-	previousWeight = avgWeight - scale.get_offset();
+	// non blocking tare, kept in software so readings stay absolute
+	tareWeight = avgWeight;
+	currentWeight = avgWeight;
+	previousWeight = 0;
 	started = true;
 	lastRateUpdateTime = millis();
 	// scale.tare(numReadings);
 	// previousWeight = scale.get_units(numReadings);
 }
 
-void LoadCell::update() {
+bool LoadCell::update() {
 	unsigned long now = millis();
+	if (postStopActive) {
+		// a new shot started, the readings belong to it
+		postStopActive = false;
+		cnt = 0;
+		tallySum = 0.0f;
+		batchOpen = false;
+	}
 	if (!started){
 		start(now);
-		return;
+		return false;
 	}
 	else if (now - lastRateUpdateTime < sampleInterval) { 
-		return; 
+		return false; 
 	}
 	
-	if (!nonBlockingReadWeight()) { return; }
+	if (!nonBlockingReadWeight()) { return false; }
 
 	// float scaleReading = scale.get_units(numReadings);
 	// float scaleReading = scale.get_units();
 	// float dw = abs(scaleReading - previousWeight);
-	float netWeight = avgWeight - scale.get_offset();
+	currentWeight = avgWeight;
+	float netWeight = avgWeight - tareWeight;
 	float dw = abs(netWeight - previousWeight);
 	float dt = (now - lastRateUpdateTime) / 1000.0;
 
@@ -97,6 +370,81 @@ void LoadCell::update() {
 	// previousWeight = scaleReading;
 	previousWeight = netWeight;
 	lastRateUpdateTime = now;
+	return true;
+}
+
+float LoadCell::getFeedRate() const {
+	return smoothedRate;
+}
+
+float LoadCell::getWeight() const {
+	return currentWeight;
+}
+
+// start() tares on the first reading, and only settled conversions are read
+bool LoadCell::hasSettledWeight() const {
+	return started;
+}
+
+bool LoadCell::isFlowing() const {
+	return smoothedRate >= feedRateThreshold;
+}
+
+void LoadCell::restartStopDetection() {
+	weightInd = 0;
+	fill(weightWindow.begin(), weightWindow.end(), 0.0f);
+	weightObsCnt = 0;
+	rateStoppedSince = 0;
+	weightStoppedSince = 0;
+}
+
+bool LoadCell::knowsEmptyWeight() const {
+	return rtcEmptyWeightKnown;
+}
+
+float LoadCell::getRemainingMass() const {
+	return currentWeight - rtcEmptyWeight;
+}
+
+bool LoadCell::hasMassRemaining() const {
+	return !rtcEmptyWeightKnown || getRemainingMass() > minRemainingMass;
+}
+
+void LoadCell::beginPostStop() {
+	if (!started) { return; }
+	unsigned long now = millis();
+	// extrapolate the last sample to the stop decision
+	postStopWeight = currentWeight - smoothedRate * (now - lastRateUpdateTime) / 1000.0f;
+	postStopStart = now;
+	postStopActive = true;
+	cnt = 0;
+	tallySum = 0.0f;
+	batchOpen = false;
+}
+
+bool LoadCell::updatePostStop() {
+	if (!postStopActive || millis() - postStopStart < postStopSettleTime) { return false; }
+	if (!nonBlockingReadWeight()) { return false; }
+	postStopActive = false;
+	postStopMass = postStopWeight - avgWeight;
+	return true;
+}
+
+bool LoadCell::isMeasuringPostStop() const {
+	return postStopActive;
+}
+
+float LoadCell::getPostStopMass() const {
+	return postStopMass;
+}
+
+void LoadCell::learnEmptyWeight() {
+	if (!started) { return; }
+	rtcEmptyWeight = rtcEmptyWeightKnown
+		? (1.0f - emptyWeightLearningRate) * rtcEmptyWeight + emptyWeightLearningRate * currentWeight
+		: currentWeight;
+	rtcEmptyWeightKnown = true;
+	Serial.print("Empty hopper weight: "); Serial.println(rtcEmptyWeight, 1);
 }
 
 
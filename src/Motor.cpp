@@ -1,24 +1,254 @@
 #include "Motor.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_sig_map.h"
+#include "freertos/task.h"
 // Preserve motor speed after deep sleep
 RTC_DATA_ATTR float rtcMotorVoltage = -1.0f;
+// Jam statistics
+RTC_DATA_ATTR unsigned int rtcJamCount = 0;
+RTC_DATA_ATTR unsigned int rtcJamClearedCount = 0;
 
 Motor::Motor(int pwmPin, int directionPin)
     : pwmPin(pwmPin), directionPin(directionPin) {}
 
 void Motor::setup() {
-	rtc_gpio_hold_dis((gpio_num_t)directionPin);
-	rtc_gpio_hold_dis((gpio_num_t)pwmPin);  
+	loadCharacterization();
 	pinMode(pwmPin, OUTPUT);
     pinMode(directionPin, OUTPUT);
     analogWriteFrequency(motorPWMFrequency);
 	analogWrite(pwmPin, 0);
     analogWrite(directionPin, 0);
+	esp_timer_create_args_t pulseTimerArgs = {};
+	pulseTimerArgs.callback = &Motor::onPulseTimer;
+	pulseTimerArgs.arg = this;
+	pulseTimerArgs.name = "motorPulse";
+	esp_timer_create(&pulseTimerArgs, &pulseTimer);
+	beginChimes();
 	reset();
 }
 
+void Motor::loadCharacterization() {
+	prefs.begin("motor", false);
+	float keepRunning = prefs.getFloat("keepRunning", -1.0f);
+	breakawayVoltage = prefs.getFloat("breakaway", -1.0f);
+	motorPWMFrequency = prefs.getInt("pwmFreq", motorPWMFrequency);
+	if (keepRunning > 0.0f) {
+		motorMinVoltage = min(keepRunning + minVoltageMargin, motorMaxVoltage);
+	}
+}
+
+void Motor::applyCharacterization(float breakaway, float keepRunning) {
+	breakawayVoltage = breakaway;
+	motorMinVoltage = min(keepRunning + minVoltageMargin, motorMaxVoltage);
+	prefs.putFloat("breakaway", breakaway);
+	prefs.putFloat("keepRunning", keepRunning);
+}
+
+void Motor::applyPwmFrequency(int frequency) {
+	setPwmFrequency(frequency);
+	prefs.putInt("pwmFreq", frequency);
+}
+
+void Motor::setPwmFrequency(int frequency) {
+	motorPWMFrequency = frequency;
+	// a playing note restores the carrier when it ends
+	if (!isPlaying()) { setCarrierFrequency(frequency); }
+}
+
+int Motor::getPwmFrequency() const {
+	return motorPWMFrequency;
+}
+
+void Motor::setKickEnabled(bool enabled) {
+	kickEnabled = enabled;
+}
+
+bool Motor::isActive() const {
+	return motorVoltage > 0 || outputOverridden() || isPlaying();
+}
+
+bool Motor::outputOverridden() const {
+	return braking || kicking || pulseActive || recoveryPhase != RECOVERY_IDLE;
+}
+
+void Motor::startPulsing(float voltage, unsigned long period, float onFraction) {
+	stopPulsing();
+	pulseVoltage = constrain(voltage, 0, motorMaxVoltage);
+	motorVoltage = pulseVoltage;
+	setPulse(period, onFraction);
+	pulseActive = true;
+	pulseOn = false;
+	pulseEdge();
+}
+
+void Motor::setPulse(unsigned long period, float onFraction) {
+	pulsePeriod = period;
+	pulseOnFraction = constrain(onFraction, 0.0f, 1.0f);
+}
+
+void Motor::stopPulsing() {
+	pulseActive = false;
+	haltPulseTimer();
+	pulseOn = false;
+}
+
+// Callers clear pulseActive or set the recovery phase first, so an edge that fires after the
+// stop writes nothing. One already past that check is waited out: it runs for microseconds on
+// the esp_timer task, the wait is bounded in case that task is held off
+void Motor::haltPulseTimer() {
+	if (pulseTimer) { esp_timer_stop(pulseTimer); }
+	for (int i = 0; pulseBusy && i < maxHaltYields; i++) { taskYIELD(); }
+}
+
+bool Motor::isPulsing() const {
+	return pulseActive;
+}
+
+void Motor::onPulseTimer(void* arg) {
+	static_cast<Motor*>(arg)->pulseEdge();
+}
+
+void Motor::pulseEdge() {
+	pulseBusy = true;
+	if (pulseActive && recoveryPhase == RECOVERY_IDLE) {
+		pulseOn = !pulseOn;
+		unsigned long onTime = (unsigned long)(pulsePeriod * pulseOnFraction);
+		unsigned long duration = pulseOn ? onTime : pulsePeriod - onTime;
+		analogWrite(pwmPin, pulseOn ? voltageToDuty(pulseVoltage) : 0);
+		esp_timer_start_once(pulseTimer, (uint64_t)duration * 1000ULL);
+	}
+	pulseBusy = false;
+}
+
 void Motor::reset() {
+	bool wasRunning = motorVoltage > 0;
+	stopPulsing();
+	recoveryPhase = RECOVERY_IDLE;
+	recoveryAttempts = 0;
+	analogWrite(directionPin, 0);
 	setVoltage(0, true);
 	motorStartTime = 0;
+	if (wasRunning && stopMode == STOP_BRAKE) {
+		// short brake: both H-bridge inputs high
+		analogWrite(pwmPin, 255);
+		analogWrite(directionPin, 255);
+		braking = true;
+		brakeStartTime = millis();
+	}
+}
+
+void Motor::endBrake() {
+	braking = false;
+	analogWrite(directionPin, 0);
+	analogWrite(pwmPin, voltageToDuty(motorVoltage));
+}
+
+StopMode Motor::getStopMode() const {
+	return stopMode;
+}
+
+void Motor::update() {
+	if (braking && millis() - brakeStartTime >= brakeTime) {
+		endBrake();
+	}
+	if (kicking && millis() - kickStartTime >= kickTime) {
+		kicking = false;
+		analogWrite(pwmPin, voltageToDuty(motorVoltage));
+	}
+	if (recoveryPhase == RECOVERY_IDLE) { return; }
+	unsigned long elapsed = millis() - recoveryPhaseStart;
+	if (recoveryPhase == RECOVERY_REVERSE && elapsed >= reversePulseTime) {
+		beginRecoveryPhase(RECOVERY_FORWARD);
+	}
+	else if (recoveryPhase == RECOVERY_FORWARD && elapsed >= forwardPulseTime) {
+		beginRecoveryPhase(++recoveryPulse < recoveryPulses ? RECOVERY_REVERSE : RECOVERY_IDLE);
+	}
+}
+
+bool Motor::startRecovery() {
+	if (recoveryAttempts >= maxRecoveryAttempts) {
+		recoveryGiveUps++;
+		return false;
+	}
+	if (recoveryAttempts == 0) { rtcJamCount++; }
+	recoveryAttempts++;
+	recoveryAttemptCount++;
+	recoveryPulse = 0;
+	// set before the halt so an edge already past the timer leaves the pins alone
+	recoveryPhase = RECOVERY_REVERSE;
+	haltPulseTimer();
+	beginRecoveryPhase(RECOVERY_REVERSE);
+	return true;
+}
+
+void Motor::beginRecoveryPhase(RecoveryPhase phase) {
+	recoveryPhase = phase;
+	recoveryPhaseStart = millis();
+	switch (phase) {
+		case RECOVERY_REVERSE:
+			analogWrite(pwmPin, 0);
+			analogWrite(directionPin, voltageToDuty(recoveryVoltage));
+			break;
+		case RECOVERY_FORWARD:
+			analogWrite(directionPin, 0);
+			analogWrite(pwmPin, voltageToDuty(recoveryVoltage));
+			break;
+		default:
+			// back to the commanded speed
+			analogWrite(directionPin, 0);
+			if (pulseActive) {
+				pulseOn = false;
+				pulseEdge();
+			}
+			else {
+				analogWrite(pwmPin, voltageToDuty(motorVoltage));
+			}
+			break;
+	}
+}
+
+bool Motor::isRecovering() const {
+	return recoveryPhase != RECOVERY_IDLE;
+}
+
+int Motor::getRecoveryAttempts() const {
+	return recoveryAttempts;
+}
+
+void Motor::recoveryCleared() {
+	if (recoveryAttempts == 0) { return; }
+	recoveryAttempts = 0;
+	rtcJamClearedCount++;
+}
+
+void Motor::report() {
+	if (recoveryAttemptCount == 0) { return; }
+	Serial.printf("Jam recovery: %lu attempts, %lu jams given up, jams cleared/detected %u/%u\n",
+	              recoveryAttemptCount, recoveryGiveUps, rtcJamClearedCount, rtcJamCount);
+}
+
+void Motor::cutoff() {
+	const int pins[] = { pwmPin, directionPin };
+	for (int pin : pins) {
+		gpio_set_level((gpio_num_t)pin, 0);
+		// plain GPIO output: LEDC duty writes no longer reach the pin
+		esp_rom_gpio_connect_out_signal(pin, SIG_GPIO_OUT_IDX, false, false);
+	}
+	cutOff = true;
+}
+
+void Motor::clearCutoff() {
+	if (!cutOff) { return; }
+	const int pins[] = { pwmPin, directionPin };
+	for (int pin : pins) {
+		int8_t channel = analogGetChannel(pin);
+		if (channel >= 0) { ledcAttachPin(pin, channel); }
+	}
+	cutOff = false;
+}
+
+bool Motor::isCutOff() const {
+	return cutOff;
 }
 
 void Motor::setMotorStartTime() {
@@ -38,18 +268,90 @@ bool Motor::shouldStop() const {
 }
 
 void Motor::setVoltage(float newVoltage, bool forceSet) {
+	if (applyVoltage(newVoltage, forceSet)) {
+		motorSpeed = voltageToSpeed(motorVoltage);
+	}
+}
+
+// Feed speed in %: evenly spaced speeds give evenly spaced flow
+void Motor::setSpeed(float newSpeed, bool forceSet) {
+	int speed = (int)lroundf(constrain(newSpeed, 0.0f, 100.0f));
+	float voltage = motorMinVoltage + (motorMaxVoltage - motorMinVoltage) * speedMap.toDrive(speed);
+	if (applyVoltage(voltage, forceSet)) {
+		motorSpeed = speed;
+	}
+}
+
+float Motor::voltageToSpeed(float voltage) const {
+	if (voltage <= 0.0f || motorMaxVoltage <= motorMinVoltage) { return 0.0f; }
+	return speedMap.fromDrive((voltage - motorMinVoltage) / (motorMaxVoltage - motorMinVoltage));
+}
+
+bool Motor::calibrateSpeed(const FlowModel& model) {
+	bool calibrated = speedMap.calibrate(model, motorMinVoltage, motorMaxVoltage);
+	Serial.println(calibrated ? "Feed speed curve: learned" : "Feed speed curve: default");
+	return calibrated;
+}
+
+float Motor::getSpeed() const {
+	return motorSpeed;
+}
+
+float Motor::getSpeedStep() const {
+	return motorSpeedStep;
+}
+
+float Motor::getRatePerSpeed() const {
+	return speedMap.getRatePerSpeed();
+}
+
+// Returns false when rate limited
+bool Motor::applyVoltage(float newVoltage, bool forceSet) {
 	if (!forceSet && lastMotorUpdate == 0) {
 		lastMotorUpdate = millis();
-		return;
+		return false;
 	}
 	else if (!forceSet && (millis() - lastMotorUpdate < motorUpdateInterval)) {
-		return;
+		return false;
 	}
 	newVoltage = constrain(newVoltage, 0, motorMaxVoltage);
-	int setpoint = (int)((newVoltage / motorMaxVoltage) * 255);
-	analogWrite(pwmPin, setpoint);
+	bool starting = motorVoltage == 0 && newVoltage > 0;
+	if (braking && newVoltage > 0) {
+		braking = false;
+		analogWrite(directionPin, 0);
+	}
+	if (kicking && (newVoltage == 0 || newVoltage >= breakawayVoltage)) {
+		kicking = false;
+	}
+	if (starting && kickEnabled && newVoltage < breakawayVoltage && recoveryPhase == RECOVERY_IDLE) {
+		// break away at the measured voltage, update() settles to the requested one
+		analogWrite(pwmPin, voltageToDuty(breakawayVoltage));
+		kicking = true;
+		kickStartTime = millis();
+	}
+	// brake, kick and recovery pulses own the pins, the new voltage applies once they end
+	else if (!outputOverridden()) {
+		analogWrite(pwmPin, voltageToDuty(newVoltage));
+	}
 	motorVoltage = newVoltage;
 	lastMotorUpdate = millis();
+	return true;
+}
+
+// Duty is scaled by the measured supply so the motor sees the commanded voltage
+// however far the battery has sagged
+int Motor::voltageToDuty(float voltage) const {
+	return (int)(constrain(voltage / supplyVoltage, 0.0f, 1.0f) * 255);
+}
+
+void Motor::setSupplyVoltage(float voltage) {
+	if (voltage < minSupplyVoltage || fabsf(voltage - supplyVoltage) < supplyVoltageEpsilon) {
+		return;
+	}
+	supplyVoltage = voltage;
+	if (motorVoltage > 0 && !outputOverridden()) {
+		analogWrite(pwmPin, voltageToDuty(motorVoltage));
+	}
 }
 
 float Motor::getVoltage() const {
@@ -64,15 +366,20 @@ float Motor::getMaxVoltage() const {
     return motorMaxVoltage;
 }
 
-float Motor::getVoltageStep() const {
-    return motorVoltageStep;
+// Called by the ChimeSequencer for each note, 0 at rests and at the end
+void Motor::playTone(int frequency) {
+	bool rest = frequency <= 0;
+	setCarrierFrequency(rest ? motorPWMFrequency : frequency);
+	// a stopped motor has no drive to modulate, give it a little
+	if (motorVoltage == 0 && !outputOverridden()) {
+		analogWrite(pwmPin, rest ? 0 : voltageToDuty(idleSoundVoltage));
+	}
 }
 
-void Motor::makeSound(int frequency, int duration) {
-	// Serial.println("Making Noise");
-	analogWriteFrequency(frequency);
-	setVoltage(0.3, true);
-	delay(duration);
-	setVoltage(0, true);
-	analogWriteFrequency(motorPWMFrequency);
+// Only the motor channel changes, duty is kept so the mean voltage stays the same
+void Motor::setCarrierFrequency(int frequency) {
+	int8_t channel = analogGetChannel(pwmPin);
+	if (channel >= 0) {
+		ledcChangeFrequency(channel, frequency, 8);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "MotorCharacterizer.h"
+
+MotorCharacterizer::MotorCharacterizer(Motor& motor, LoadCell& loadCell)
+	: motor(motor), loadCell(loadCell) {}
+
+void MotorCharacterizer::start() {
+	Serial.println("Motor characterisation started");
+	breakawayVoltage = -1.0f;
+	keepRunningVoltage = -1.0f;
+	stepCnt = 0;
+	// measure the real breakaway, not the start kick
+	motor.setKickEnabled(false);
+	beginStep(CHAR_BASELINE, 0.0f);
+}
+
+void MotorCharacterizer::abort() {
+	if (!isRunning()) { return; }
+	Serial.println("Motor characterisation aborted");
+	finish(CHAR_FAILED);
+}
+
+bool MotorCharacterizer::isRunning() const {
+	return phase == CHAR_BASELINE || phase == CHAR_RAMP_UP || phase == CHAR_RAMP_DOWN;
+}
+
+bool MotorCharacterizer::succeeded() const {
+	return phase == CHAR_DONE;
+}
+
+float MotorCharacterizer::getBreakawayVoltage() const {
+	return breakawayVoltage;
+}
+
+float MotorCharacterizer::getKeepRunningVoltage() const {
+	return keepRunningVoltage;
+}
+
+int MotorCharacterizer::getStepCount() const {
+	return stepCnt;
+}
+
+float MotorCharacterizer::getStepVoltage(int ind) const {
+	return stepVoltage[ind];
+}
+
+float MotorCharacterizer::getStepRate(int ind) const {
+	return stepRate[ind];
+}
+
+float MotorCharacterizer::getStepNoise(int ind) const {
+	return stepNoise[ind];
+}
+
+void MotorCharacterizer::beginStep(CharacterizerPhase newPhase, float newVoltage) {
+	phase = newPhase;
+	voltage = newVoltage;
+	motor.setVoltage(voltage, true);
+	stepStartTime = millis();
+	n = 0;
+	sumT = sumW = sumTT = sumTW = sumDiffSq = 0;
+}
+
+void MotorCharacterizer::addReading(float weight, unsigned long now) {
+	float t = (now - stepStartTime) / 1000.0f;
+	if (n > 0) {
+		float diff = weight - prevWeight;
+		sumDiffSq += diff * diff;
+	}
+	prevWeight = weight;
+	n++;
+	sumT += t;
+	sumW += weight;
+	sumTT += t * t;
+	sumTW += t * weight;
+}
+
+bool MotorCharacterizer::finishStep(float& rate, float& noise) {
+	const int minReadings = 4;
+	if (n < minReadings) { return false; }
+	float denom = n * sumTT - sumT * sumT;
+	// weight falls while beans leave the hopper
+	rate = denom > 0.0f ? -(n * sumTW - sumT * sumW) / denom : 0.0f;
+	// successive differences ignore the trend
+	noise = sqrtf(sumDiffSq / (2.0f * (n - 1)));
+	if (stepCnt < maxSteps) {
+		stepVoltage[stepCnt] = voltage;
+		stepRate[stepCnt] = rate;
+		stepNoise[stepCnt] = noise;
+		stepCnt++;
+	}
+	return true;
+}
+
+bool MotorCharacterizer::isMoving(float rate, float noise) const {
+	float noiseThreshold = max(baselineNoise * vibrationFactor, baselineNoise + minNoiseDelta);
+	return rate > minFlowRate || noise > noiseThreshold;
+}
+
+bool MotorCharacterizer::update() {
+	if (!isRunning()) { return false; }
+
+	unsigned long now = millis();
+	float weight;
+	if (loadCell.readSample(weight) && now - stepStartTime >= stepSettleTime) {
+		addReading(weight, now);
+	}
+	if (now - stepStartTime < stepDwellTime) { return true; }
+
+	float rate, noise;
+	if (!finishStep(rate, noise)) {
+		Serial.println("Motor characterisation: no load cell readings");
+		finish(CHAR_FAILED);
+		return false;
+	}
+	bool moving = isMoving(rate, noise);
+
+	switch (phase) {
+		case CHAR_BASELINE:
+			baselineNoise = noise;
+			beginStep(CHAR_RAMP_UP, rampStartVoltage);
+			break;
+
+		case CHAR_RAMP_UP:
+			if (moving) {
+				breakawayVoltage = voltage;
+				keepRunningVoltage = voltage;
+				beginStep(CHAR_RAMP_DOWN, voltage - rampStep);
+			}
+			else if (voltage + rampStep > motor.getMaxVoltage() + 0.001f) {
+				Serial.println("Motor characterisation: no motion detected");
+				finish(CHAR_FAILED);
+			}
+			else {
+				beginStep(CHAR_RAMP_UP, voltage + rampStep);
+			}
+			break;
+
+		case CHAR_RAMP_DOWN:
+			if (moving && voltage - rampStep > 0.0f) {
+				keepRunningVoltage = voltage;
+				beginStep(CHAR_RAMP_DOWN, voltage - rampStep);
+			}
+			else {
+				if (moving) { keepRunningVoltage = voltage; }
+				finish(CHAR_DONE);
+			}
+			break;
+
+		default:
+			break;
+	}
+	return isRunning();
+}
+
+void MotorCharacterizer::finish(CharacterizerPhase result) {
+	phase = result;
+	motor.reset();
+	motor.setKickEnabled(true);
+	if (result == CHAR_DONE) {
+		Serial.print("Breakaway voltage: "); Serial.println(breakawayVoltage, 2);
+		Serial.print("Keep running voltage: "); Serial.println(keepRunningVoltage, 2);
+	}
+}
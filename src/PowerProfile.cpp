@@ -0,0 +1,118 @@
+#include "PowerProfile.h"
+#include "esp_timer.h"
+
+static constexpr PowerStateConfig powerStates[POWER_STATE_COUNT] = {
+	{ "idle",           POWER_LEVEL_MIN, true  },
+	{ "waiting",        POWER_LEVEL_MIN, false }, // 10 ms ticks, waking from sleep would only add latency
+	{ "feeding",        POWER_LEVEL_APB, false }, // PWM must neither stop nor change frequency
+	{ "chime",          POWER_LEVEL_APB, false },
+	{ "characterizing", POWER_LEVEL_APB, false },
+};
+
+void PowerProfile::setup() {
+	maxFrequency = getCpuFrequencyMhz();
+	esp_pm_config_esp32s3_t config = {};
+	config.max_freq_mhz = maxFrequency;
+	config.min_freq_mhz = minFrequency;
+	config.light_sleep_enable = true;
+	// light sleep also needs CONFIG_FREERTOS_USE_TICKLESS_IDLE, frequency scaling alone does not
+	lightSleepEnabled = esp_pm_configure(&config) == ESP_OK;
+	if (!lightSleepEnabled) {
+		config.light_sleep_enable = false;
+		scalingEnabled = esp_pm_configure(&config) == ESP_OK;
+	}
+	else {
+		scalingEnabled = true;
+	}
+	if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "cpuState", &cpuMaxLock) != ESP_OK) { cpuMaxLock = nullptr; }
+	if (esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "apbState", &apbMaxLock) != ESP_OK) { apbMaxLock = nullptr; }
+	if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "noSleepState", &noSleepLock) != ESP_OK) { noSleepLock = nullptr; }
+
+	// no locks are held in POWER_IDLE
+	state = POWER_IDLE;
+	lastAccountTime = esp_timer_get_time();
+}
+
+void PowerProfile::printConfiguration() const {
+	Serial.printf("Power management: %d-%d MHz %s, automatic light sleep %s\n",
+	              minFrequency, maxFrequency,
+	              scalingEnabled ? "enabled" : "not supported by this build",
+	              lightSleepEnabled ? "enabled" : "not supported by this build");
+}
+
+void PowerProfile::setLock(esp_pm_lock_handle_t lock, bool held, bool wasHeld) {
+	if (lock == nullptr || held == wasHeld) { return; }
+	if (held) { esp_pm_lock_acquire(lock); }
+	else { esp_pm_lock_release(lock); }
+}
+
+void PowerProfile::applyLocks(const PowerStateConfig& from, const PowerStateConfig& to) {
+	bool apbFrom = from.level >= POWER_LEVEL_APB, apbTo = to.level >= POWER_LEVEL_APB;
+	bool cpuFrom = from.level == POWER_LEVEL_MAX, cpuTo = to.level == POWER_LEVEL_MAX;
+	bool awakeFrom = !from.lightSleep, awakeTo = !to.lightSleep;
+	// take the new locks before dropping the old ones so the frequency never dips in between
+	setLock(apbMaxLock, apbFrom || apbTo, apbFrom);
+	setLock(cpuMaxLock, cpuFrom || cpuTo, cpuFrom);
+	setLock(noSleepLock, awakeFrom || awakeTo, awakeFrom);
+	setLock(apbMaxLock, apbTo, apbFrom || apbTo);
+	setLock(cpuMaxLock, cpuTo, cpuFrom || cpuTo);
+	setLock(noSleepLock, awakeTo, awakeFrom || awakeTo);
+}
+
+void PowerProfile::setState(PowerState newState) {
+	if (newState == state) { return; }
+	account();
+	applyLocks(powerStates[state], powerStates[newState]);
+	state = newState;
+}
+
+PowerState PowerProfile::getState() const {
+	return state;
+}
+
+bool PowerProfile::allowsLightSleep() const {
+	return lightSleepEnabled && powerStates[state].lightSleep;
+}
+
+bool PowerProfile::isLightSleepEnabled() const {
+	return lightSleepEnabled;
+}
+
+void PowerProfile::beginWait() {
+	account();
+	waiting = true;
+}
+
+void PowerProfile::endWait() {
+	account();
+	waiting = false;
+}
+
+PowerLevel PowerProfile::currentLevel() const {
+	if (!scalingEnabled || !waiting) { return POWER_LEVEL_MAX; }
+	return powerStates[state].level;
+}
+
+void PowerProfile::account() {
+	int64_t now = esp_timer_get_time();
+	int64_t elapsed = now - lastAccountTime;
+	levelTime[currentLevel()] += elapsed;
+	stateTime[state] += elapsed;
+	lastAccountTime = now;
+}
+
+void PowerProfile::report() {
+	account();
+	int64_t total = 0;
+	for (int i = 0; i < POWER_LEVEL_COUNT; i++) { total += levelTime[i]; }
+	if (total <= 0) { return; }
+
+	Serial.printf("Time at %d MHz%s: %.1f%%, 80 MHz: %.1f%%, %d MHz: %.1f%%\n",
+	              minFrequency, lightSleepEnabled ? " or light sleep" : "",
+	              100.0 * levelTime[POWER_LEVEL_MIN] / total,
+	              100.0 * levelTime[POWER_LEVEL_APB] / total,
+	              maxFrequency, 100.0 * levelTime[POWER_LEVEL_MAX] / total);
+	for (int i = 0; i < POWER_STATE_COUNT; i++) {
+		Serial.printf("  %s: %.1f s\n", powerStates[i].name, stateTime[i] / 1e6);
+	}
+}
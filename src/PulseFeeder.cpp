@@ -0,0 +1,24 @@
+#include "PulseFeeder.h"
+
+PulseFeeder::PulseFeeder(Motor& motor)
+	: motor(motor) {}
+
+unsigned long PulseFeeder::periodFor(float fraction) const {
+	unsigned long periodForOnTime = (unsigned long)(minOnTime / fraction);
+	return constrain(periodForOnTime, minPeriod, maxPeriod);
+}
+
+void PulseFeeder::start(float pulseVoltage, unsigned long now) {
+	onFraction = initialOnFraction;
+	period = periodFor(onFraction);
+	lastUpdateTime = now;
+	motor.startPulsing(pulseVoltage, period, onFraction);
+}
+
+void PulseFeeder::update(float targetRate, float measuredRate, unsigned long now) {
+	float dt = (now - lastUpdateTime) / 1000.0f;
+	lastUpdateTime = now;
+	onFraction = constrain(onFraction + fractionGain * (targetRate - measuredRate) * dt, minOnFraction, maxOnFraction);
+	period = periodFor(onFraction);
+	motor.setPulse(period, onFraction);
+}
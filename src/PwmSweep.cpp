@@ -0,0 +1,102 @@
+#include "PwmSweep.h"
+
+const int PwmSweep::frequencies[PwmSweep::numFrequencies] = { 1000, 4000, 10000, 16000, 20000, 25000 };
+
+PwmSweep::PwmSweep(Motor& motor, MotorCharacterizer& characterizer)
+	: motor(motor), characterizer(characterizer) {}
+
+void PwmSweep::start() {
+	Serial.println("PWM sweep started");
+	Serial.println("pwm_hz,voltage,rate_gps,noise_g");
+	running = true;
+	freqInd = 0;
+	initialFrequency = motor.getPwmFrequency();
+	bestFrequency = -1;
+	bestBreakaway = -1.0f;
+	bestKeepRunning = -1.0f;
+	startFrequency();
+}
+
+void PwmSweep::startFrequency() {
+	motor.setPwmFrequency(frequencies[freqInd]);
+	characterizer.start();
+}
+
+void PwmSweep::abort() {
+	if (!running) { return; }
+	characterizer.abort();
+	bestFrequency = -1;
+	finish();
+}
+
+bool PwmSweep::succeeded() const {
+	return !running && bestFrequency > 0;
+}
+
+int PwmSweep::getBestFrequency() const {
+	return bestFrequency;
+}
+
+float PwmSweep::getBreakawayVoltage() const {
+	return bestBreakaway;
+}
+
+float PwmSweep::getKeepRunningVoltage() const {
+	return bestKeepRunning;
+}
+
+bool PwmSweep::update() {
+	if (!running) { return false; }
+	if (characterizer.update()) { return true; }
+
+	int frequency = frequencies[freqInd];
+	dumpRun();
+	if (characterizer.succeeded()) {
+		float breakaway = characterizer.getBreakawayVoltage();
+		float keepRunning = characterizer.getKeepRunningVoltage();
+		Serial.printf("# %d Hz: breakaway %.2f V, keep running %.2f V\n", frequency, breakaway, keepRunning);
+		if (frequency >= minQuietFrequency && isBetter(breakaway, keepRunning)) {
+			bestFrequency = frequency;
+			bestBreakaway = breakaway;
+			bestKeepRunning = keepRunning;
+		}
+	}
+	else {
+		Serial.printf("# %d Hz: failed\n", frequency);
+	}
+
+	if (++freqInd < numFrequencies) {
+		startFrequency();
+	}
+	else {
+		finish();
+	}
+	return running;
+}
+
+void PwmSweep::dumpRun() const {
+	int frequency = frequencies[freqInd];
+	for (int i = 0; i < characterizer.getStepCount(); i++) {
+		Serial.printf("%d,%.2f,%.3f,%.3f\n", frequency, characterizer.getStepVoltage(i),
+		              characterizer.getStepRate(i), characterizer.getStepNoise(i));
+	}
+}
+
+bool PwmSweep::isBetter(float breakaway, float keepRunning) const {
+	if (bestFrequency < 0) { return true; }
+	if (keepRunning < bestKeepRunning - tolerance) { return true; }
+	if (keepRunning > bestKeepRunning + tolerance) { return false; }
+	// same within a step: less stiction hysteresis wins, ties go to the higher frequency
+	return breakaway - keepRunning <= bestBreakaway - bestKeepRunning + tolerance;
+}
+
+void PwmSweep::finish() {
+	running = false;
+	motor.setPwmFrequency(initialFrequency);
+	if (bestFrequency > 0) {
+		Serial.printf("Best PWM frequency: %d Hz\n", bestFrequency);
+	}
+	else {
+		Serial.println("PWM sweep: no usable frequency");
+	}
+}
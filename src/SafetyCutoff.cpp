@@ -0,0 +1,72 @@
+#include "SafetyCutoff.h"
+#include "esp_timer.h"
+
+SafetyCutoff::SafetyCutoff(Motor& motor)
+	: motor(motor) {}
+
+void SafetyCutoff::arm() {
+	rearm = true;
+	armed = true;
+}
+
+void SafetyCutoff::disarm() {
+	armed = false;
+}
+
+void SafetyCutoff::check(float weight, int64_t readyTime) {
+	checks++;
+	if (!armed || tripped) { return; }
+	if (rearm.exchange(false)) {
+		baseline = weight;
+		windowIndex = 0;
+		windowCount = 0;
+	}
+
+	window[windowIndex] = weight;
+	windowTime[windowIndex] = readyTime;
+	windowIndex = (windowIndex + 1) % slopeWindow;
+	if (windowCount < slopeWindow) { windowCount++; }
+
+	// the hopper gets lighter as it feeds, either sign is taken like LoadCell does
+	float dispensed = fabsf(baseline - weight);
+	float rate = 0.0f;
+	if (windowCount == slopeWindow) {
+		// windowIndex is the oldest sample once the window is full
+		float span = (readyTime - windowTime[windowIndex]) / 1e6f;
+		if (span > 0) { rate = fabsf(window[windowIndex] - weight) / span; }
+	}
+
+	if (fabsf(weight) > maxMeasuredMass) { cutoff(SAFETY_OVER_RANGE, weight, readyTime); }
+	else if (dispensed > maxDoseMass) { cutoff(SAFETY_MAX_DOSE, dispensed, readyTime); }
+	else if (rate > maxFeedRate) { cutoff(SAFETY_RUNAWAY, rate, readyTime); }
+
+	maxCheckLatency = max(maxCheckLatency, esp_timer_get_time() - readyTime);
+}
+
+void SafetyCutoff::cutoff(SafetyTrip reason, float value, int64_t readyTime) {
+	motor.cutoff();
+	tripLatency = esp_timer_get_time() - readyTime;
+	trip = reason;
+	tripValue = value;
+	trips++;
+	armed = false;
+	tripped = true;
+}
+
+bool SafetyCutoff::hasTripped() const {
+	return tripped;
+}
+
+void SafetyCutoff::acknowledge() {
+	if (!tripped) { return; }
+	static const char* const reasons[] = { "none", "max dose", "over range", "runaway" };
+	Serial.printf("Safety cutoff: %s (%.1f %s), motor off %.2f ms after the sample was ready\n",
+	              reasons[trip], tripValue, trip == SAFETY_RUNAWAY ? "g/s" : "g", tripLatency / 1e3);
+	tripped = false;
+}
+
+void SafetyCutoff::report() {
+	if (checks == 0) { return; }
+	Serial.printf("Safety: %lu samples checked, worst decision %.2f ms after ready, %lu trips\n",
+	              checks, maxCheckLatency / 1e3, trips);
+}
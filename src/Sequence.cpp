@@ -0,0 +1,43 @@
+#include "Sequence.h"
+
+void Sequence::start() {
+	phase = 0;
+	stepTime = millis();
+	running = true;
+}
+
+void Sequence::cancel() {
+	running = false;
+}
+
+bool Sequence::isRunning() const {
+	return running;
+}
+
+bool Sequence::update() {
+	// steps that continue at once run in the same call
+	while (running && (long)(millis() - stepTime) >= 0) {
+		step();
+	}
+	return running;
+}
+
+unsigned long Sequence::timeToNextStep() const {
+	if (!running) { return ULONG_MAX; }
+	long remaining = (long)(stepTime - millis());
+	return remaining > 0 ? remaining : 0;
+}
+
+void Sequence::waitFor(unsigned long duration, int nextPhase) {
+	phase = nextPhase;
+	stepTime = millis() + duration;
+}
+
+void Sequence::next(int nextPhase) {
+	phase = nextPhase;
+	stepTime = millis();
+}
+
+void Sequence::finish() {
+	running = false;
+}
@@ -0,0 +1,152 @@
+#include "SleepPins.h"
+#include "driver/rtc_io.h"
+#include "soc/gpio_periph.h"
+
+// The planned level or isolation through the digital mux, the same for RTC and digital only pads
+static esp_err_t setDigitalPad(const SleepPin& row) {
+	esp_err_t err = ESP_OK;
+	auto check = [&err](esp_err_t result) { if (err == ESP_OK) { err = result; } };
+	gpio_num_t pin = row.pin;
+	if (rtc_gpio_is_valid_gpio(pin)) { check(rtc_gpio_deinit(pin)); }
+	check(gpio_set_pull_mode(pin, GPIO_FLOATING));
+	if (row.mode == SLEEP_PIN_ISOLATE) {
+		check(gpio_set_direction(pin, GPIO_MODE_DISABLE));
+	}
+	else {
+		check(gpio_set_level(pin, row.mode == SLEEP_PIN_HIGH));
+		check(gpio_set_direction(pin, GPIO_MODE_OUTPUT));
+	}
+	return err;
+}
+
+static esp_err_t applySleepPin(const SleepPin& row) {
+	esp_err_t err = ESP_OK;
+	auto check = [&err](esp_err_t result) { if (err == ESP_OK) { err = result; } };
+	gpio_num_t pin = row.pin;
+
+	// A pin still held from the last sleep takes the new config when the hold is released
+	// below, so the pad goes from one planned state to the next without a glitch
+	if (row.mode == SLEEP_PIN_WAKE) {
+		// EXT1 reads the pad through the RTC mux
+		check(rtc_gpio_init(pin));
+		check(rtc_gpio_set_direction(pin, RTC_GPIO_MODE_INPUT_ONLY));
+		check(rtc_gpio_pullup_dis(pin));
+		check(rtc_gpio_pulldown_en(pin));
+		check(gpio_hold_dis(pin));
+		return err;
+	}
+
+	check(setDigitalPad(row));
+	check(gpio_hold_dis(pin));
+	check(gpio_hold_en(pin));
+	return err;
+}
+
+void releaseSleepPins(const SleepPin* pins, int count) {
+	for (int i = 0; i < count; i++) {
+		const SleepPin& row = pins[i];
+		if (!row.present) { continue; }
+		if (row.mode == SLEEP_PIN_WAKE) {
+			// hand the pad back from the RTC mux to the button input
+			rtc_gpio_deinit(row.pin);
+			continue;
+		}
+		// the registers lost the plan in deep sleep, the hold kept it at the pad: restore it
+		// before letting go so nothing moves until the component sets the pin up
+		setDigitalPad(row);
+		gpio_hold_dis(row.pin);
+	}
+}
+
+void applySleepPins(const SleepPin* pins, int count, esp_err_t* results) {
+	for (int i = 0; i < count; i++) {
+		esp_err_t err = pins[i].present ? applySleepPin(pins[i]) : ESP_OK;
+		if (results) { results[i] = err; }
+	}
+	// digital only pads keep their hold through deep sleep only with this
+	gpio_deep_sleep_hold_en();
+}
+
+uint64_t sleepWakeMask(const SleepPin* pins, int count) {
+	uint64_t mask = 0;
+	for (int i = 0; i < count; i++) {
+		if (pins[i].present && pins[i].mode == SLEEP_PIN_WAKE) { mask |= 1ULL << pins[i].pin; }
+	}
+	return mask;
+}
+
+// Digital pad state as the GPIO matrix and IO_MUX registers have it
+struct PadState {
+	bool gpioFunction;     // routed to the GPIO matrix, not a peripheral like UART or USB
+	bool outputEnabled;
+	bool high;
+	bool inputEnabled;
+	bool pullUp;
+	bool pullDown;
+};
+
+static PadState readPad(int pin) {
+	uint32_t mux = REG_READ(GPIO_PIN_MUX_REG[pin]);
+	uint32_t enable = pin < 32 ? REG_READ(GPIO_ENABLE_REG) : REG_READ(GPIO_ENABLE1_REG);
+	uint32_t out = pin < 32 ? REG_READ(GPIO_OUT_REG) : REG_READ(GPIO_OUT1_REG);
+	uint32_t bit = 1UL << (pin % 32);
+	PadState state;
+	state.gpioFunction = ((mux >> MCU_SEL_S) & MCU_SEL_V) == PIN_FUNC_GPIO;
+	state.outputEnabled = (enable & bit) != 0;
+	state.high = (out & bit) != 0;
+	state.inputEnabled = (mux & FUN_IE) != 0;
+	state.pullUp = (mux & FUN_PU) != 0;
+	state.pullDown = (mux & FUN_PD) != 0;
+	return state;
+}
+
+static bool matchesPlan(const SleepPin& row, const PadState& pad) {
+	if (pad.pullUp || pad.pullDown) { return false; }
+	switch (row.mode) {
+		case SLEEP_PIN_ISOLATE: return !pad.outputEnabled && !pad.inputEnabled;
+		case SLEEP_PIN_LOW:     return pad.outputEnabled && !pad.high;
+		case SLEEP_PIN_HIGH:    return pad.outputEnabled && pad.high;
+		default:                return true;
+	}
+}
+
+bool auditSleepPins(const SleepPin* pins, int count, const esp_err_t* results) {
+	static const char* const modes[] = { "isolate", "low", "high", "wake" };
+	bool ok = true;
+	uint64_t planned = 0;
+
+	Serial.println("Sleep pin audit:");
+	for (int i = 0; i < count; i++) {
+		const SleepPin& row = pins[i];
+		if (!row.present) { continue; }
+		planned |= 1ULL << row.pin;
+		bool rowOk = results[i] == ESP_OK;
+		Serial.printf("  %-12s GPIO%-2d %-8s", row.name, row.pin, modes[row.mode]);
+		if (row.mode == SLEEP_PIN_WAKE) {
+			// the RTC mux has the pad, the digital registers say nothing about it
+			Serial.print("rtc input, pulldown            ");
+		}
+		else {
+			PadState pad = readPad(row.pin);
+			rowOk = rowOk && matchesPlan(row, pad);
+			Serial.printf("oe %d out %d ie %d pu %d pd %d   ",
+			              pad.outputEnabled, pad.high, pad.inputEnabled, pad.pullUp, pad.pullDown);
+		}
+		if (results[i] != ESP_OK) { Serial.printf("%s\n", esp_err_to_name(results[i])); }
+		else { Serial.println(rowOk ? "ok" : "MISMATCH"); }
+		ok = ok && rowOk;
+	}
+
+	// a GPIO output left on by something the plan does not know about
+	for (int pin = 0; pin < SOC_GPIO_PIN_COUNT; pin++) {
+		if ((planned >> pin) & 1ULL) { continue; }
+		if (!GPIO_IS_VALID_OUTPUT_GPIO(pin) || GPIO_PIN_MUX_REG[pin] == 0) { continue; }
+		PadState pad = readPad(pin);
+		if (!pad.gpioFunction || !pad.outputEnabled) { continue; }
+		Serial.printf("  GPIO%-2d driven %s, not in the plan\n", pin, pad.high ? "high" : "low");
+		ok = false;
+	}
+
+	Serial.println(ok ? "Sleep pins match the plan" : "Sleep pins do NOT match the plan");
+	return ok;
+}
@@ -0,0 +1,44 @@
+#include "SpeedMap.h"
+
+constexpr array<float, numSpeeds> SpeedMap::defaultTable;
+
+int SpeedMap::fromDrive(float fraction) const {
+	int lo = 0, hi = numSpeeds - 1;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (table[mid] < fraction) { lo = mid + 1; }
+		else { hi = mid; }
+	}
+	if (lo > 0 && fraction - table[lo - 1] < table[lo] - fraction) { lo--; }
+	return lo;
+}
+
+// Inverts the learned voltage -> rate curve so equal speed steps give equal flow steps.
+// Falls back to the default table until the curve covers the whole voltage span.
+bool SpeedMap::calibrate(const FlowModel& model, float minVoltage, float maxVoltage) {
+	float minRate = model.rateAt(minVoltage);
+	float maxRate = model.rateAt(maxVoltage);
+	float span = maxVoltage - minVoltage;
+	if (minRate < 0.0f || maxRate <= minRate || span <= 0.0f) {
+		table = defaultTable.data();
+		ratePerSpeed = -1.0f;
+		return false;
+	}
+	float prev = 0.0f;
+	for (int i = 0; i < numSpeeds; ++i) {
+		float rate = minRate + (maxRate - minRate) * i / (numSpeeds - 1);
+		float voltage = model.voltageForRate(rate);
+		float fraction = voltage < 0.0f ? 1.0f : constrain((voltage - minVoltage) / span, 0.0f, 1.0f);
+		prev = max(prev, fraction);
+		calibratedTable[i] = prev;
+	}
+	calibratedTable[0] = 0.0f;
+	calibratedTable[numSpeeds - 1] = 1.0f;
+	table = calibratedTable.data();
+	ratePerSpeed = (maxRate - minRate) / (numSpeeds - 1);
+	return true;
+}
+
+float SpeedMap::getRatePerSpeed() const {
+	return ratePerSpeed;
+}
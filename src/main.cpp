@@ -1,14 +1,9 @@
 #include <Arduino.h>
-#include <Button.h> //uh, buttons
 #include "driver/rtc_io.h" //deepsleep
 #include "LoadCell.h" //loadcell setting
 #include "Motor.h" //Motor setting
 #include "Board.h" //Board setting
 
-//deepsleep/wake defines, using EXT0 cause internal pullup power domain is needed.
-#define BUTTON_PIN_BITMASK(GPIO) (1ULL << GPIO)  // 2 ^ GPIO_NUMBER in hex
-#define WAKEUP_GPIO              GPIO_NUM_5     // Only RTC IO are allowed
-
 Board board;
 
 void setup() {
@@ -30,6 +25,8 @@ void loop() {
     //button status evaluations
     board.handleButtonAction();
     board.processFeedingCycle();
+    board.runSequences();
 
-    delay(10);
+    // sleeps until there is something to do
+    board.waitForEvents();
 }
\ No newline at end of file
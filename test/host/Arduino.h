@@ -0,0 +1,51 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the ESP32 Arduino core for the firmware headers to compile on the host.
+// Nothing that touches hardware is defined; a suite that calls it does not link
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define FALLING 0x02
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::min;
+using std::max;
+
+int digitalRead(uint8_t pin);
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode);
+
+// ms, the suites advance it themselves
+inline unsigned long hostMillis = 0;
+inline unsigned long millis() { return hostMillis; }
+
+class HostSerial {
+public:
+	size_t print(const char* text) { return fputs(text, stdout); }
+	size_t print(double value, int digits = 2) { return ::printf("%.*f", digits, value); }
+	size_t print(long value) { return ::printf("%ld", value); }
+	size_t print(int value) { return ::printf("%d", value); }
+	size_t print(unsigned long value) { return ::printf("%lu", value); }
+	template <typename T> size_t println(T value) { size_t n = print(value); return n + print("\n"); }
+	size_t println(double value, int digits) { size_t n = print(value, digits); return n + print("\n"); }
+	size_t println() { return print("\n"); }
+	size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		va_list args;
+		va_start(args, format);
+		int n = vprintf(format, args);
+		va_end(args);
+		return n;
+	}
+};
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_HX711_H
+#define HOST_HX711_H
+
+#include <stdint.h>
+
+class HX711 {
+public:
+	float get_units(uint8_t times = 1);
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+class Preferences {};
+
+#endif
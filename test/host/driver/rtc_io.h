@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_RTC_IO_H
+#define HOST_DRIVER_RTC_IO_H
+
+#include "driver/gpio.h"
+
+#endif
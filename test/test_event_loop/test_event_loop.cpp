@@ -0,0 +1,206 @@
+#include <unity.h>
+#include <climits>
+#include <functional>
+#include <map>
+// the unit under test is compiled into the suite, the firmware itself is not built on the host
+#include "EventLoop.cpp"
+
+// Link seams: an event group that never blocks. A wait with nothing set runs duringWait,
+// standing in for whatever arrives while the loop is blocked, then times out
+struct HostEventGroup { EventBits_t bits = 0; };
+static HostEventGroup group;
+static TickType_t lastWaitTicks = 0;
+static std::function<void()> duringWait;
+
+EventGroupHandle_t xEventGroupCreate() {
+	group = HostEventGroup();
+	return &group;
+}
+EventBits_t xEventGroupSetBits(EventGroupHandle_t events, EventBits_t bits) {
+	return events->bits |= bits;
+}
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t events, EventBits_t bits, BaseType_t* woken) {
+	events->bits |= bits;
+	return pdTRUE;
+}
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t events, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t ticks) {
+	lastWaitTicks = ticks;
+	if (!(events->bits & bits) && duringWait) {
+		auto arrive = duringWait;
+		duringWait = nullptr;
+		arrive();
+	}
+	EventBits_t result = events->bits;
+	if (clearOnExit && (result & bits)) { events->bits &= ~bits; }
+	return result;
+}
+
+static bool inIsr = false;
+BaseType_t xPortInIsrContext() { return inIsr; }
+esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+
+// Pins: DOUT level, its interrupt and the wake configuration per pin
+static int doutLevel = HIGH;
+static void (*sampleHandler)(void*) = nullptr;
+static void* sampleArg = nullptr;
+static std::map<int, bool> interruptEnabled;
+static std::map<int, gpio_int_type_t> interruptType;
+static std::map<int, gpio_int_type_t> wakeType;     // GPIO_INTR_DISABLE when not a wake source
+
+int digitalRead(uint8_t pin) { return doutLevel; }
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode) {
+	sampleHandler = handler;
+	sampleArg = arg;
+	interruptEnabled[pin] = true;
+}
+esp_err_t gpio_intr_enable(gpio_num_t pin) { interruptEnabled[pin] = true; return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t pin) { interruptEnabled[pin] = false; return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) { interruptType[pin] = type; return ESP_OK; }
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) { wakeType[pin] = type; return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t pin) { wakeType[pin] = GPIO_INTR_DISABLE; return ESP_OK; }
+
+static const int doutPin = 9;
+static const gpio_num_t upPin = 5;
+static const gpio_num_t downPin = 6;
+
+void setUp() {
+	lastWaitTicks = 0;
+	duringWait = nullptr;
+	inIsr = false;
+	doutLevel = HIGH;
+	sampleHandler = nullptr;
+	interruptEnabled.clear();
+	interruptType.clear();
+	wakeType.clear();
+}
+
+void tearDown() {}
+
+// The deadline becomes the block time, capped so the tick conversion cannot overflow
+void test_deadline_is_the_block_time() {
+	EventLoop loop;
+	loop.setup(false);
+	const unsigned long timeouts[] = { 0, 10, 59999, 60000, 60001, ULONG_MAX };
+	const TickType_t ticks[] = { 0, 10, 59999, 60000, 60000, 60000 };
+	for (int i = 0; i < 6; i++) {
+		TEST_ASSERT_EQUAL_INT(0, loop.wait(timeouts[i], false, false));
+		TEST_ASSERT_EQUAL_INT(ticks[i], lastWaitTicks);
+	}
+}
+
+// A button event before or during the wait ends it, once
+void test_button_bit() {
+	EventLoop loop;
+	loop.setup(false);
+	EventLoop::notify(&loop);
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_BUTTON, loop.wait(1000, false, false));
+	TEST_ASSERT_EQUAL_INT(0, loop.wait(1000, false, false));
+	duringWait = [&loop] { EventLoop::notify(&loop); };
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_BUTTON, loop.wait(1000, false, false));
+}
+
+// Samples from the acquisition task only wake a wait that wants them
+void test_sample_bit_only_when_wanted() {
+	EventLoop loop;
+	loop.setup(false);
+	duringWait = [&loop] { EventLoop::notifySample(&loop); };
+	TEST_ASSERT_EQUAL_INT(0, loop.wait(1000, false, false));
+	duringWait = [&loop] { EventLoop::notifySample(&loop); };
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_SAMPLE, loop.wait(1000, false, true));
+	duringWait = [&loop] { EventLoop::notify(&loop); EventLoop::notifySample(&loop); };
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_BUTTON | LOOP_EVENT_SAMPLE, loop.wait(1000, false, true));
+	TEST_ASSERT_EQUAL_INT(0, loop.wait(1000, false, true));
+}
+
+// DOUT: its interrupt is armed only inside waits that want a sample, and a conversion
+// that is already waiting ends the wait without an edge
+void test_sample_pin() {
+	EventLoop loop;
+	loop.setup(false);
+	loop.setSamplePin(doutPin);
+	TEST_ASSERT_FALSE(interruptEnabled[doutPin]);
+
+	bool armedDuringWait = false;
+	duringWait = [&] { armedDuringWait = interruptEnabled[doutPin]; };
+	TEST_ASSERT_EQUAL_INT(0, loop.wait(1000, false, false));
+	TEST_ASSERT_FALSE(armedDuringWait);
+
+	duringWait = [&] {
+		armedDuringWait = interruptEnabled[doutPin];
+		sampleHandler(sampleArg);
+	};
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_SAMPLE, loop.wait(1000, false, true));
+	TEST_ASSERT_TRUE(armedDuringWait);
+	TEST_ASSERT_FALSE(interruptEnabled[doutPin]);
+
+	doutLevel = LOW;
+	armedDuringWait = false;
+	duringWait = [&] { armedDuringWait = true; };
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_SAMPLE, loop.wait(1000, false, true));
+	TEST_ASSERT_FALSE(interruptEnabled[doutPin]);
+	TEST_ASSERT_FALSE(armedDuringWait);
+}
+
+// Button wake levels are armed only for light sleep waits, and the edge interrupt each
+// pin had is back after the wait
+void test_wake_pins_armed_for_light_sleep() {
+	EventLoop loop;
+	loop.setup(true);
+	loop.addWakePin(upPin, HIGH, GPIO_INTR_ANYEDGE);
+	loop.addWakePin(downPin, HIGH, GPIO_INTR_DISABLE);
+
+	gpio_int_type_t upWake = GPIO_INTR_DISABLE;
+	gpio_int_type_t downWake = GPIO_INTR_DISABLE;
+	duringWait = [&] { upWake = wakeType[upPin]; downWake = wakeType[downPin]; };
+	loop.wait(1000, false, false);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_DISABLE, upWake);
+
+	duringWait = [&] { upWake = wakeType[upPin]; downWake = wakeType[downPin]; };
+	loop.wait(1000, true, false);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_HIGH_LEVEL, upWake);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_HIGH_LEVEL, downWake);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_DISABLE, wakeType[upPin]);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_ANYEDGE, interruptType[upPin]);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_DISABLE, interruptType[downPin]);
+}
+
+// Without light sleep configured nothing is armed
+void test_no_wake_pins_without_light_sleep() {
+	EventLoop loop;
+	loop.setup(false);
+	loop.addWakePin(upPin, HIGH, GPIO_INTR_ANYEDGE);
+	gpio_int_type_t upWake = GPIO_INTR_DISABLE;
+	duringWait = [&] { upWake = wakeType[upPin]; };
+	loop.wait(1000, true, false);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_DISABLE, upWake);
+}
+
+// The wake level interrupt disarms the pins itself, it would fire again on return
+void test_isr_wake_disarms_at_once() {
+	EventLoop loop;
+	loop.setup(true);
+	loop.addWakePin(upPin, HIGH, GPIO_INTR_ANYEDGE);
+	gpio_int_type_t afterWake = GPIO_INTR_HIGH_LEVEL;
+	duringWait = [&] {
+		inIsr = true;
+		EventLoop::notify(&loop);
+		inIsr = false;
+		afterWake = wakeType[upPin];
+	};
+	TEST_ASSERT_EQUAL_INT(LOOP_EVENT_BUTTON, loop.wait(1000, true, false));
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_DISABLE, afterWake);
+	TEST_ASSERT_EQUAL_INT(GPIO_INTR_ANYEDGE, interruptType[upPin]);
+}
+
+int main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_deadline_is_the_block_time);
+	RUN_TEST(test_button_bit);
+	RUN_TEST(test_sample_bit_only_when_wanted);
+	RUN_TEST(test_sample_pin);
+	RUN_TEST(test_wake_pins_armed_for_light_sleep);
+	RUN_TEST(test_no_wake_pins_without_light_sleep);
+	RUN_TEST(test_isr_wake_disarms_at_once);
+	return UNITY_END();
+}
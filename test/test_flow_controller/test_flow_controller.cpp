@@ -0,0 +1,141 @@
+#include <unity.h>
+#include <vector>
+// the unit under test is compiled into the suite, the firmware itself is not built on the host
+#include "FlowController.cpp"
+
+// Plant: first order lag plus dead time, the model FlowController assumes.
+// Drive (feed speed in %) above minDrive gives gain g/s per %
+class FopdtPlant {
+public:
+	FopdtPlant(float gain, float timeConstant, float deadTime)
+		: gain(gain), timeConstant(timeConstant),
+		  delayLine((size_t)lroundf(deadTime / subStep) + 1, 0.0f) {}
+
+	// rate at the end of an interval of dt s with drive applied throughout
+	float advance(float drive, float dt) {
+		for (int i = 0; i < (int)lroundf(dt / subStep); i++) {
+			delayLine[head] = max(drive - minDrive, 0.0f);
+			head = (head + 1) % delayLine.size();
+			float delayed = delayLine[head];   // the oldest, one dead time back
+			rate += subStep / timeConstant * (gain * delayed - rate);
+		}
+		return rate;
+	}
+
+private:
+	static constexpr float subStep = 0.01f;  // s
+	static constexpr float minDrive = 0.0f;
+	float gain;
+	float timeConstant;
+	std::vector<float> delayLine;
+	size_t head = 0;
+	float rate = 0.0f;
+};
+
+static const float minDrive = 0.0f;
+static const float maxDrive = 100.0f;
+static const float plantGain = 0.025f;        // g/s per %, FlowController's default
+static const float plantTimeConstant = 1.2f;  // s, FlowController's model
+static const unsigned long sampleInterval = 500; // ms, the load cell rate update
+static const float dt = sampleInterval / 1000.0f;
+static const float deadTimes[] = { 0.5f, 1.0f, 1.5f, 2.0f, 3.0f };
+
+void setUp() {
+	rtcDeadTime = -1.0f;
+	hostMillis = 1000;
+}
+
+void tearDown() {}
+
+// Open loop drive steps, as the shot history would hold them, recover each plant dead time
+void test_identifies_dead_time() {
+	static const float driveSteps[] = { 30, 60, 20, 80, 40, 70, 10, 50 };
+	const int samplesPerStep = 12;
+	for (float deadTime : deadTimes) {
+		rtcDeadTime = -1.0f;
+		FlowController controller(minDrive, maxDrive);
+		FopdtPlant plant(plantGain, plantTimeConstant, deadTime);
+		controller.reset(minDrive, hostMillis);
+		for (float drive : driveSteps) {
+			for (int i = 0; i < samplesPerStep; i++) {
+				hostMillis += sampleInterval;
+				controller.record(drive, plant.advance(drive, dt), hostMillis);
+			}
+		}
+		controller.identifyDeadTime();
+		char message[48];
+		snprintf(message, sizeof(message), "plant dead time %.1f s", deadTime);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(dt / 2, deadTime, controller.getDeadTime(), message);
+	}
+}
+
+// Closed loop target step with the identified dead time: settles, little overshoot
+void test_step_response_settles() {
+	const float target = 0.6f;
+	for (float deadTime : deadTimes) {
+		rtcDeadTime = deadTime;
+		FlowController controller(minDrive, maxDrive);
+		FopdtPlant plant(plantGain, plantTimeConstant, deadTime);
+		controller.setTarget(target);
+		controller.reset(minDrive, hostMillis);
+		float drive = minDrive;
+		float peak = 0.0f;
+		float worstLateError = 0.0f;
+		for (int i = 0; i < 120; i++) {            // 60 s
+			hostMillis += sampleInterval;
+			float rate = plant.advance(drive, dt);
+			drive = controller.update(rate, hostMillis);
+			peak = max(peak, rate);
+			if (i >= 100) { worstLateError = max(worstLateError, fabsf(rate - target)); }
+		}
+		char message[48];
+		snprintf(message, sizeof(message), "plant dead time %.1f s", deadTime);
+		TEST_ASSERT_LESS_THAN_FLOAT_MESSAGE(target * 1.1f, peak, message);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.02f, 0.0f, worstLateError, message);
+	}
+}
+
+// A target beyond the motor saturates the drive; once it is back in range the integral
+// must neither hold the drive up (windup) nor leave it far below what the target needs
+void test_no_windup_after_saturation() {
+	const float target = 0.6f;
+	for (float deadTime : deadTimes) {
+		rtcDeadTime = deadTime;
+		FlowController controller(minDrive, maxDrive);
+		FopdtPlant plant(plantGain, plantTimeConstant, deadTime);
+		controller.setTarget(plantGain * maxDrive * 2.0f);
+		controller.reset(minDrive, hostMillis);
+		float drive = minDrive;
+		for (int i = 0; i < 60; i++) {             // 30 s pinned at maxDrive
+			hostMillis += sampleInterval;
+			drive = controller.update(plant.advance(drive, dt), hostMillis);
+		}
+		TEST_ASSERT_FLOAT_WITHIN(0.001f, maxDrive, drive);
+
+		controller.setTarget(target);
+		int saturatedSamples = 0;
+		float lowest = 10.0f;
+		float worstLateError = 0.0f;
+		for (int i = 0; i < 120; i++) {            // 60 s
+			hostMillis += sampleInterval;
+			float rate = plant.advance(drive, dt);
+			drive = controller.update(rate, hostMillis);
+			if (drive >= maxDrive) { saturatedSamples++; }
+			lowest = min(lowest, rate);
+			if (i >= 100) { worstLateError = max(worstLateError, fabsf(rate - target)); }
+		}
+		char message[48];
+		snprintf(message, sizeof(message), "plant dead time %.1f s", deadTime);
+		TEST_ASSERT_LESS_THAN_MESSAGE(2, saturatedSamples, message);
+		TEST_ASSERT_LESS_THAN_FLOAT_MESSAGE(target * 0.25f, target - lowest, message);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.02f, 0.0f, worstLateError, message);
+	}
+}
+
+int main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_identifies_dead_time);
+	RUN_TEST(test_step_response_settles);
+	RUN_TEST(test_no_windup_after_saturation);
+	return UNITY_END();
+}
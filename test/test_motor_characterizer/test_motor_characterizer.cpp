@@ -0,0 +1,141 @@
+#include <unity.h>
+// the unit under test is compiled into the suite, the firmware itself is not built on the host
+#include "MotorCharacterizer.cpp"
+
+// Plant: a motor with stiction feeding beans off a hopper on the load cell. It starts
+// turning at breakaway and keeps turning down to keepRunning, below that it stalls
+struct StallPlant {
+	float breakaway = 2.25f;               // V
+	float keepRunning = 1.75f;             // V
+	float flowPerVolt = 0.3f;              // g/s per V while turning
+	float noise = 0.02f;                   // g, load cell noise
+	float voltage = 0.0f;
+	bool turning = false;
+	float mass = 300.0f;                   // g on the load cell
+	unsigned long lastSample = 0;
+	unsigned int seed = 1;
+	int resets = 0;
+
+	void setVoltage(float newVoltage) {
+		voltage = newVoltage;
+		if (voltage < keepRunning) { turning = false; }
+		else if (voltage >= breakaway) { turning = true; }
+	}
+
+	// one conversion per 100 ms like the HX711 at 10 SPS
+	bool sample(unsigned long now, float& weight) {
+		if (now - lastSample < 100) { return false; }
+		float dt = (now - lastSample) / 1000.0f;
+		lastSample = now;
+		if (turning) { mass -= flowPerVolt * voltage * dt; }
+		seed = seed * 1103515245u + 12345u;
+		float jitter = ((seed >> 16) % 1000 / 999.0f - 0.5f) * 2.0f * noise;
+		weight = mass + jitter;
+		return true;
+	}
+};
+static StallPlant plant;
+
+// Link seams: only what MotorCharacterizer calls, backed by the plant
+Motor::Motor(int pwmPin, int directionPin) : pwmPin(pwmPin), directionPin(directionPin) {}
+void Motor::setVoltage(float newVoltage, bool forceSet) { plant.setVoltage(newVoltage); }
+float Motor::getMaxVoltage() const { return motorMaxVoltage; }
+void Motor::setKickEnabled(bool enabled) { kickEnabled = enabled; }
+void Motor::reset() {
+	plant.setVoltage(0.0f);
+	plant.resets++;
+}
+void Motor::playTone(int frequency) {}
+void ChimeSequencer::makeSound(int frequency, int duration) {}
+void ChimeSequencer::play(const ChimeNote* notes, size_t count, ChimePriority priority) {}
+void ChimeSequencer::flush() {}
+bool ChimeSequencer::isPlaying() const { return false; }
+
+LoadCell::LoadCell(int doutPin, int clkPin, float cf, float a)
+	: calibrationFactor(cf), DOUT(doutPin), CLK(clkPin), alpha(a) {}
+bool LoadCell::readSample(float& weight) { return plant.sample(millis(), weight); }
+void LoadCell::HopperCheck::step() {}
+
+static const unsigned long timeLimit = 10UL * 60UL * 1000UL; // ms, far beyond any real run
+
+static void runCharacterization(MotorCharacterizer& characterizer) {
+	characterizer.start();
+	unsigned long start = millis();
+	while (characterizer.update() && millis() - start < timeLimit) {
+		hostMillis += 10;
+	}
+}
+
+void setUp() {
+	plant = StallPlant();
+	hostMillis = 1000;
+	plant.lastSample = hostMillis;
+}
+
+void tearDown() {}
+
+void test_finds_breakaway_and_keep_running() {
+	Motor motor(7, 44);
+	LoadCell loadCell(9, 8, 1.0f);
+	MotorCharacterizer characterizer(motor, loadCell);
+	runCharacterization(characterizer);
+
+	TEST_ASSERT_TRUE(characterizer.succeeded());
+	// the ramp moves in 0.1 V steps: the first step at or above breakaway, the last one
+	// still above keep running
+	TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.3f, characterizer.getBreakawayVoltage());
+	TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.8f, characterizer.getKeepRunningVoltage());
+	TEST_ASSERT_EQUAL_INT(1, plant.resets);
+	TEST_ASSERT_FALSE(plant.turning);
+}
+
+void test_follows_the_plant() {
+	plant.breakaway = 2.85f;
+	plant.keepRunning = 1.45f;
+	Motor motor(7, 44);
+	LoadCell loadCell(9, 8, 1.0f);
+	MotorCharacterizer characterizer(motor, loadCell);
+	runCharacterization(characterizer);
+
+	TEST_ASSERT_TRUE(characterizer.succeeded());
+	TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.9f, characterizer.getBreakawayVoltage());
+	TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.5f, characterizer.getKeepRunningVoltage());
+}
+
+// A wheel that never turns up to the maximum voltage fails the run and stops the motor
+void test_stalled_motor_fails() {
+	plant.breakaway = 10.0f;
+	Motor motor(7, 44);
+	LoadCell loadCell(9, 8, 1.0f);
+	MotorCharacterizer characterizer(motor, loadCell);
+	runCharacterization(characterizer);
+
+	TEST_ASSERT_FALSE(characterizer.isRunning());
+	TEST_ASSERT_FALSE(characterizer.succeeded());
+	TEST_ASSERT_EQUAL_INT(1, plant.resets);
+	TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, plant.voltage);
+}
+
+// Without load cell readings nothing can be decided, the run fails rather than guess
+void test_no_readings_fails() {
+	Motor motor(7, 44);
+	LoadCell loadCell(9, 8, 1.0f);
+	MotorCharacterizer characterizer(motor, loadCell);
+	characterizer.start();
+	unsigned long start = millis();
+	while (characterizer.update() && millis() - start < timeLimit) {
+		hostMillis += 10;
+		plant.lastSample = hostMillis;     // no conversion is ever due
+	}
+	TEST_ASSERT_FALSE(characterizer.succeeded());
+	TEST_ASSERT_EQUAL_INT(0, characterizer.getStepCount());
+}
+
+int main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_finds_breakaway_and_keep_running);
+	RUN_TEST(test_follows_the_plant);
+	RUN_TEST(test_stalled_motor_fails);
+	RUN_TEST(test_no_readings_fails);
+	return UNITY_END();
+}
@@ -0,0 +1,128 @@
+#include <unity.h>
+// the unit under test is compiled into the suite, the firmware itself is not built on the host
+#include "SafetyCutoff.cpp"
+
+// Link seams: SafetyCutoff only cuts the motor, count the cuts
+static int cutoffs = 0;
+Motor::Motor(int pwmPin, int directionPin) : pwmPin(pwmPin), directionPin(directionPin) {}
+void Motor::cutoff() { cutoffs++; }
+void Motor::playTone(int frequency) {}
+void ChimeSequencer::makeSound(int frequency, int duration) {}
+void ChimeSequencer::play(const ChimeNote* notes, size_t count, ChimePriority priority) {}
+void ChimeSequencer::flush() {}
+bool ChimeSequencer::isPlaying() const { return false; }
+
+// Conversions at 10 SPS like the HX711, the hopper losing mass as it feeds
+static const int64_t samplePeriod = 100000;   // us
+static const float startWeight = 400.0f;      // g on the load cell
+static int64_t readyTime = 0;
+static unsigned int seed = 1;
+
+// g, the load cell noise
+static float jitter() {
+	seed = seed * 1103515245u + 12345u;
+	return ((seed >> 16) % 1000 / 999.0f - 0.5f) * 0.1f;
+}
+
+// Feeds one conversion, true if the cutoff tripped on it
+static bool feed(SafetyCutoff& safety, float weight) {
+	readyTime += samplePeriod;
+	safety.check(weight, readyTime);
+	return safety.hasTripped();
+}
+
+// Index of the sample that tripped, -1 if none did in count samples of rate g/s
+static int feedRate(SafetyCutoff& safety, float rate, int count, bool noise = true, float from = startWeight) {
+	float weight = from;
+	for (int i = 0; i < count; i++) {
+		if (feed(safety, weight + (noise ? jitter() : 0.0f))) { return i; }
+		weight -= rate * samplePeriod / 1e6f;
+	}
+	return -1;
+}
+
+void setUp() {
+	cutoffs = 0;
+	readyTime = 1000000;
+	seed = 1;
+}
+
+void tearDown() {}
+
+// 12 g/s, what the safety-sim build feeds: the slope over five samples trips on the fifth
+void test_trips_on_runaway() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	safety.arm();
+	TEST_ASSERT_EQUAL_INT(4, feedRate(safety, 12.0f, 50, false));
+	TEST_ASSERT_EQUAL_INT(1, cutoffs);
+}
+
+// A steady feed past the largest dose trips on the first sample beyond 80 g
+void test_trips_on_over_dose() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	safety.arm();
+	// 0.25 g a sample is exact in float, sample 320 has dispensed exactly 80 g
+	TEST_ASSERT_EQUAL_INT(321, feedRate(safety, 2.5f, 400, false));
+	TEST_ASSERT_EQUAL_INT(1, cutoffs);
+}
+
+// A reading beyond the load cell range trips on that sample
+void test_trips_out_of_range() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	safety.arm();
+	for (int i = 0; i < 20; i++) {
+		TEST_ASSERT_FALSE(feed(safety, startWeight - 0.2f * i + jitter()));
+	}
+	TEST_ASSERT_TRUE(feed(safety, 2500.0f));
+	TEST_ASSERT_EQUAL_INT(1, cutoffs);
+}
+
+// A normal 2 g/s shot of 18 g never trips
+void test_quiet_on_normal_shot() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	safety.arm();
+	TEST_ASSERT_EQUAL_INT(-1, feedRate(safety, 2.0f, 90));
+	TEST_ASSERT_EQUAL_INT(0, cutoffs);
+}
+
+// Pulsed feeding: 6 g/s bursts for half of each 1 s period, 3 g/s on average for 20 s
+void test_quiet_on_pulsed_feed() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	safety.arm();
+	float weight = startWeight;
+	for (int i = 0; i < 200; i++) {
+		TEST_ASSERT_FALSE(feed(safety, weight + jitter()));
+		bool on = (i % 10) < 5;
+		if (on) { weight -= 6.0f * samplePeriod / 1e6f; }
+	}
+	TEST_ASSERT_EQUAL_INT(0, cutoffs);
+}
+
+// Disarmed the cutoff ignores everything; arming takes a new baseline
+void test_disarmed_and_rearmed() {
+	Motor motor(7, 44);
+	SafetyCutoff safety(motor);
+	TEST_ASSERT_FALSE(feed(safety, 2500.0f));
+	// two 50 g shots: 100 g from the first baseline, the second counts from its own
+	safety.arm();
+	TEST_ASSERT_EQUAL_INT(-1, feedRate(safety, 2.5f, 200));
+	safety.arm();
+	TEST_ASSERT_EQUAL_INT(-1, feedRate(safety, 2.5f, 200, true, startWeight - 50.0f));
+	TEST_ASSERT_EQUAL_INT(0, cutoffs);
+}
+
+int main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_trips_on_runaway);
+	RUN_TEST(test_trips_on_over_dose);
+	RUN_TEST(test_trips_out_of_range);
+	RUN_TEST(test_quiet_on_normal_shot);
+	RUN_TEST(test_quiet_on_pulsed_feed);
+	RUN_TEST(test_disarmed_and_rearmed);
+	return UNITY_END();
+}
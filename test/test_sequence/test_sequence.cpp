@@ -0,0 +1,212 @@
+#include <unity.h>
+#include <vector>
+// the unit under test is compiled into the suite, the firmware itself is not built on the host
+#include "Sequence.cpp"
+
+// Records each step as phase and the millis() it ran at. Phase 0 waits, 1 continues at
+// once, 2 waits again, 3 finishes
+class Recorder : public Sequence {
+public:
+	struct Step { int phase; unsigned long time; };
+	std::vector<Step> steps;
+	unsigned long firstWait = 100;
+	unsigned long secondWait = 250;
+
+private:
+	void step() override {
+		steps.push_back({ phase, millis() });
+		switch (phase) {
+			case 0: waitFor(firstWait, 1); break;
+			case 1: next(2); break;
+			case 2: waitFor(secondWait, 3); break;
+			default: finish(); break;
+		}
+	}
+};
+
+// The phases of Board::SleepSequence, which is not built on the host: brake, chime, poll
+// until the chime is done, then the committed power down
+class SleepLike : public Sequence {
+public:
+	enum { STOP, CHIME, CHIME_PLAYING, POWER_DOWN };
+	bool chimePlaying = false;
+	bool poweredDown = false;
+	bool isCommitted() const { return isRunning() && phase >= POWER_DOWN; }
+
+private:
+	void step() override {
+		switch (phase) {
+			case STOP: waitFor(500, CHIME); break;
+			case CHIME: chimePlaying = true; next(CHIME_PLAYING); break;
+			case CHIME_PLAYING:
+				if (chimePlaying) { waitFor(10, CHIME_PLAYING); }
+				else { next(POWER_DOWN); }
+				break;
+			case POWER_DOWN: poweredDown = true; finish(); break;
+		}
+	}
+};
+
+// What Board::updateButtons() does with a button event while the sleep runs
+static void buttonEvent(SleepLike& sleep) {
+	if (sleep.isCommitted()) { return; }
+	if (sleep.isRunning()) { sleep.cancel(); }
+}
+
+// Advances millis() to each due step and runs it, like the loop after its event wait
+static void runUntilDone(Sequence& sequence, unsigned long limit = 10000) {
+	unsigned long start = millis();
+	while (sequence.update() && millis() - start < limit) {
+		hostMillis += sequence.timeToNextStep();
+	}
+}
+
+void setUp() {
+	hostMillis = 1000;
+}
+
+void tearDown() {}
+
+void test_time_to_next_step() {
+	Recorder recorder;
+	TEST_ASSERT_FALSE(recorder.isRunning());
+	TEST_ASSERT_TRUE(recorder.timeToNextStep() == ULONG_MAX);
+	recorder.start();
+	TEST_ASSERT_EQUAL_INT(0, recorder.timeToNextStep());
+	recorder.update();
+	TEST_ASSERT_EQUAL_INT(100, recorder.timeToNextStep());
+	hostMillis += 40;
+	TEST_ASSERT_EQUAL_INT(60, recorder.timeToNextStep());
+	// overdue counts as due, never wraps to a huge wait
+	hostMillis += 500;
+	TEST_ASSERT_EQUAL_INT(0, recorder.timeToNextStep());
+}
+
+// Each step runs once it is due and not before, steps that continue at once share the call
+void test_resumes_when_due() {
+	Recorder recorder;
+	recorder.start();
+	TEST_ASSERT_TRUE(recorder.update());
+	TEST_ASSERT_EQUAL_INT(1, recorder.steps.size());
+	hostMillis += 99;
+	TEST_ASSERT_TRUE(recorder.update());
+	TEST_ASSERT_EQUAL_INT(1, recorder.steps.size());
+	hostMillis += 1;
+	TEST_ASSERT_TRUE(recorder.update());
+	TEST_ASSERT_EQUAL_INT(3, recorder.steps.size());
+	TEST_ASSERT_EQUAL_INT(250, recorder.timeToNextStep());
+	hostMillis += 250;
+	TEST_ASSERT_FALSE(recorder.update());
+
+	const int phases[] = { 0, 1, 2, 3 };
+	const unsigned long times[] = { 1000, 1100, 1100, 1350 };
+	TEST_ASSERT_EQUAL_INT(4, recorder.steps.size());
+	for (int i = 0; i < 4; i++) {
+		TEST_ASSERT_EQUAL_INT(phases[i], recorder.steps[i].phase);
+		TEST_ASSERT_EQUAL_INT(times[i], recorder.steps[i].time);
+	}
+	TEST_ASSERT_TRUE(recorder.timeToNextStep() == ULONG_MAX);
+}
+
+// A late loop runs the overdue step once, the next wait counts from then
+void test_late_update() {
+	Recorder recorder;
+	recorder.start();
+	recorder.update();
+	hostMillis += 180;
+	recorder.update();
+	TEST_ASSERT_EQUAL_INT(3, recorder.steps.size());
+	TEST_ASSERT_EQUAL_INT(250, recorder.timeToNextStep());
+}
+
+// Waits that span the millis() wrap resume on time
+void test_wait_across_millis_wrap() {
+	hostMillis = ULONG_MAX - 50;
+	Recorder recorder;
+	recorder.start();
+	recorder.update();
+	TEST_ASSERT_EQUAL_INT(100, recorder.timeToNextStep());
+	hostMillis += 99;
+	recorder.update();
+	TEST_ASSERT_EQUAL_INT(1, recorder.steps.size());
+	hostMillis += 1;
+	recorder.update();
+	TEST_ASSERT_EQUAL_INT(3, recorder.steps.size());
+	TEST_ASSERT_EQUAL_INT(49, recorder.steps[1].time);
+}
+
+// Cancelled mid wait nothing more runs; start() begins again from phase 0
+void test_cancel_and_restart() {
+	Recorder recorder;
+	recorder.start();
+	recorder.update();
+	recorder.cancel();
+	TEST_ASSERT_FALSE(recorder.isRunning());
+	TEST_ASSERT_TRUE(recorder.timeToNextStep() == ULONG_MAX);
+	hostMillis += 1000;
+	TEST_ASSERT_FALSE(recorder.update());
+	TEST_ASSERT_EQUAL_INT(1, recorder.steps.size());
+
+	recorder.start();
+	runUntilDone(recorder);
+	TEST_ASSERT_EQUAL_INT(5, recorder.steps.size());
+	TEST_ASSERT_EQUAL_INT(0, recorder.steps[1].phase);
+	TEST_ASSERT_EQUAL_INT(2000, recorder.steps[1].time);
+	TEST_ASSERT_EQUAL_INT(3, recorder.steps[4].phase);
+}
+
+// Left alone the sleep brakes, chimes until the chime is done, then powers down
+void test_sleep_runs_to_power_down() {
+	SleepLike sleep;
+	sleep.start();
+	sleep.update();
+	hostMillis += 500;
+	sleep.update();
+	TEST_ASSERT_TRUE(sleep.chimePlaying);
+	hostMillis += 200;
+	TEST_ASSERT_TRUE(sleep.update());
+	TEST_ASSERT_FALSE(sleep.poweredDown);
+	sleep.chimePlaying = false;
+	hostMillis += 10;
+	TEST_ASSERT_FALSE(sleep.update());
+	TEST_ASSERT_TRUE(sleep.poweredDown);
+}
+
+// A button during the brake or the chime cancels the sleep before the pins are touched
+void test_button_cancels_sleep() {
+	SleepLike sleep;
+	sleep.start();
+	sleep.update();
+	hostMillis += 300;
+	buttonEvent(sleep);
+	hostMillis += 1000;
+	TEST_ASSERT_FALSE(sleep.update());
+	TEST_ASSERT_FALSE(sleep.chimePlaying);
+	TEST_ASSERT_FALSE(sleep.poweredDown);
+
+	// again, this time the button comes while the chime plays
+	sleep.start();
+	sleep.update();
+	hostMillis += 500;
+	sleep.update();
+	TEST_ASSERT_TRUE(sleep.chimePlaying);
+	hostMillis += 30;
+	sleep.update();
+	buttonEvent(sleep);
+	sleep.chimePlaying = false;
+	hostMillis += 10;
+	TEST_ASSERT_FALSE(sleep.update());
+	TEST_ASSERT_FALSE(sleep.poweredDown);
+}
+
+int main(int argc, char** argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_time_to_next_step);
+	RUN_TEST(test_resumes_when_due);
+	RUN_TEST(test_late_update);
+	RUN_TEST(test_wait_across_millis_wrap);
+	RUN_TEST(test_cancel_and_restart);
+	RUN_TEST(test_sleep_runs_to_power_down);
+	RUN_TEST(test_button_cancels_sleep);
+	return UNITY_END();
+}